@@ -0,0 +1,228 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+#include <gli/gli.hpp>
+
+#include "buffer_pool.hpp"
+#include "float_convert.hpp"
+#include "format_traits.hpp"
+
+
+/*
+ * Texture atlas building for pack_atlas(): a skyline bottom-left rectangle packer, blitting
+ * with padding filled from each image's edge texels (so filtering and mips never pick up a
+ * neighbour), and a box filtered mip chain.
+ */
+namespace atlas {
+
+struct rect {
+    size_t x = 0;
+    size_t y = 0;
+    size_t width = 0;
+    size_t height = 0;
+};
+
+
+/*
+ * Keeps the top edge of everything placed so far as a list of horizontal segments and puts
+ * each rectangle where its top ends lowest, breaking ties on the narrowest segment.
+ */
+class skyline_packer {
+public:
+    skyline_packer(size_t width, size_t height) : width_(width), height_(height) {
+        skyline_.push_back({0, 0, width});
+    }
+
+    bool insert(size_t width, size_t height, size_t &x, size_t &y) {
+        size_t best = skyline_.size(), best_top = SIZE_MAX, best_width = SIZE_MAX, best_y = 0;
+        for (size_t i = 0; i < skyline_.size(); i++) {
+            size_t top_y;
+            if (!fits(i, width, height, top_y))
+                continue;
+            if (top_y + height < best_top || (top_y + height == best_top && skyline_[i].width < best_width)) {
+                best = i;
+                best_top = top_y + height;
+                best_width = skyline_[i].width;
+                best_y = top_y;
+            }
+        }
+        if (best == skyline_.size())
+            return false;
+        x = skyline_[best].x;
+        y = best_y;
+        place(best, width, height, y);
+        return true;
+    }
+
+    /* Height of the tallest column used so far */
+    size_t used_height() const {
+        size_t out = 0;
+        for (const auto &s : skyline_)
+            out = std::max(out, s.y);
+        return out;
+    }
+
+private:
+    struct segment {
+        size_t x;
+        size_t y;
+        size_t width;
+    };
+
+    /* Whether width x height fits with its left edge at segment i, and the y it would sit at */
+    bool fits(size_t i, size_t width, size_t height, size_t &y) const {
+        if (skyline_[i].x + width > width_)
+            return false;
+        y = 0;
+        size_t remaining = width;
+        for (size_t j = i; remaining > 0; j++) {
+            if (j == skyline_.size())
+                return false;
+            y = std::max(y, skyline_[j].y);
+            if (y + height > height_)
+                return false;
+            remaining -= std::min(remaining, skyline_[j].width);
+        }
+        return true;
+    }
+
+    void place(size_t i, size_t width, size_t height, size_t y) {
+        const size_t x = skyline_[i].x;
+        skyline_.insert(skyline_.begin() + std::ptrdiff_t(i), {x, y + height, width});
+
+        // Trim or drop the segments the new one now covers
+        const size_t right = x + width;
+        for (size_t j = i + 1; j < skyline_.size();) {
+            segment &s = skyline_[j];
+            if (s.x >= right)
+                break;
+            const size_t end = s.x + s.width;
+            if (end <= right) {
+                skyline_.erase(skyline_.begin() + std::ptrdiff_t(j));
+                continue;
+            }
+            s.width = end - right;
+            s.x = right;
+            break;
+        }
+
+        // Merge neighbours at the same height
+        for (size_t j = 0; j + 1 < skyline_.size();) {
+            if (skyline_[j].y == skyline_[j + 1].y) {
+                skyline_[j].width += skyline_[j + 1].width;
+                skyline_.erase(skyline_.begin() + std::ptrdiff_t(j + 1));
+            } else {
+                j++;
+            }
+        }
+    }
+
+    size_t width_;
+    size_t height_;
+    std::vector<segment> skyline_;
+};
+
+
+/*
+ * Places `sizes` (padding included) in the narrowest power of two wide atlas, up to
+ * max_size x max_size, that holds them all. Taller images go first. Returns false when they
+ * don't fit, otherwise fills `placed` (in input order) and the atlas extent.
+ */
+inline bool pack(const std::vector<rect> &sizes, size_t max_size, std::vector<rect> &placed, size_t &atlas_width, size_t &atlas_height) {
+    std::vector<size_t> order(sizes.size());
+    size_t area = 0, widest = 1;
+    for (size_t i = 0; i < sizes.size(); i++) {
+        order[i] = i;
+        area += sizes[i].width * sizes[i].height;
+        widest = std::max(widest, sizes[i].width);
+    }
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return sizes[a].height != sizes[b].height ? sizes[a].height > sizes[b].height : sizes[a].width > sizes[b].width;
+    });
+
+    size_t width = 4;
+    while (width < max_size && (width < widest || width * width < area))
+        width *= 2;
+    for (width = std::min(width, max_size);; width = std::min(width * 2, max_size)) {
+        skyline_packer packer(width, max_size);
+        placed.assign(sizes.size(), rect());
+        bool ok = true;
+        for (size_t i : order) {
+            rect &r = placed[i];
+            r.width = sizes[i].width;
+            r.height = sizes[i].height;
+            if (!packer.insert(r.width, r.height, r.x, r.y)) {
+                ok = false;
+                break;
+            }
+        }
+        if (ok) {
+            // Multiples of 4 keep the atlas usable with block compressed formats, within max_size when it is one
+            atlas_width = width;
+            atlas_height = std::min(std::max<size_t>((packer.used_height() + 3) / 4 * 4, 4), max_size);
+            return true;
+        }
+        if (width == max_size)
+            return false;
+    }
+}
+
+
+/* Fills the `padding` texels around the image at `r` by repeating its edge texels */
+inline void bleed_edges(std::uint8_t *atlas, size_t atlas_width, size_t texel_size, const rect &r, size_t padding) {
+    if (padding == 0)
+        return;
+    const size_t row_bytes = atlas_width * texel_size;
+    auto texel = [&](size_t x, size_t y) { return atlas + y * row_bytes + x * texel_size; };
+
+    for (size_t p = 1; p <= padding; p++) {
+        std::memcpy(texel(r.x, r.y - p), texel(r.x, r.y), r.width * texel_size);
+        std::memcpy(texel(r.x, r.y + r.height - 1 + p), texel(r.x, r.y + r.height - 1), r.width * texel_size);
+    }
+    for (size_t y = r.y - padding; y < r.y + r.height + padding; y++) {
+        for (size_t p = 1; p <= padding; p++) {
+            std::memcpy(texel(r.x - p, y), texel(r.x, y), texel_size);
+            std::memcpy(texel(r.x + r.width - 1 + p, y), texel(r.x + r.width - 1, y), texel_size);
+        }
+    }
+}
+
+
+/* Levels of a full mip chain down to 1x1 */
+inline size_t mip_levels(size_t width, size_t height) {
+    size_t levels = 1;
+    for (size_t extent = std::max(width, height); extent > 1; extent /= 2)
+        levels++;
+    return levels;
+}
+
+
+/* Box filters every level of a 2D texture from the one above it. Half formats are filtered as float */
+inline void generate_mips(gli::texture &tex, const format_traits &traits, size_t num_threads) {
+    for (size_t level = 1; level < tex.levels(); level++) {
+        const gli::extent3d src = tex.extent(level - 1);
+        const gli::extent3d dst = tex.extent(level);
+        if (!traits.half) {
+            traits.resize(tex.data(0, 0, level - 1), src.x, src.y, tex.data(0, 0, level), dst.x, dst.y, resize_filter::box, num_threads);
+            continue;
+        }
+        const size_t src_elements = size_t(src.x) * src.y * traits.channels;
+        const size_t dst_elements = size_t(dst.x) * dst.y * traits.channels;
+        pool::buffer widened = pool::acquire(src_elements * sizeof(float));
+        pool::buffer filtered = pool::acquire(dst_elements * sizeof(float));
+        traits.load(tex.data(0, 0, level - 1), widened.data(), size_t(src.x) * src.y, false);
+        traits.resize(widened.data(), src.x, src.y, filtered.data(), dst.x, dst.y, resize_filter::box, num_threads);
+        const auto *in = reinterpret_cast<const float *>(filtered.data());
+        auto *out = static_cast<std::uint16_t *>(tex.data(0, 0, level));
+        for (size_t i = 0; i < dst_elements; i++)
+            out[i] = float_to_half(in[i]);
+    }
+}
+
+} // namespace atlas
@@ -0,0 +1,249 @@
+#pragma once
+
+#include <new>
+#include <mutex>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+
+/*
+ * Size-classed cache of large byte buffers for file reads and conversion scratch space.
+ * Freeing a multi-MB block usually unmaps it, so the next load pays for the allocation and
+ * for faulting every page in again; handing the block back here keeps it mapped instead.
+ *
+ * Sizes are rounded up to one of four classes per power of two (at most 25% slack) and each
+ * class keeps a free list. Buffers returned while more than max_bytes are cached are freed.
+ * With huge_pages, buffers of HUGE_PAGE bytes and up are aligned to it and advised as
+ * transparent huge pages (Linux only).
+ */
+namespace pool {
+
+constexpr size_t MIN_BYTES = size_t(64) << 10;
+constexpr size_t HUGE_PAGE = size_t(2) << 20;
+constexpr size_t DEFAULT_MAX_BYTES = size_t(256) << 20;
+
+
+struct pool_stats {
+    size_t cached_bytes = 0;
+    size_t cached_buffers = 0;
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t max_bytes = 0;
+    bool huge_pages = false;
+};
+
+
+namespace detail {
+
+inline size_t floor_log2(size_t v) {
+    size_t out = 0;
+    while (v >>= 1)
+        out++;
+    return out;
+}
+
+
+/* Rounds `bytes` up to its size class, returning the class index */
+inline size_t size_class(size_t &bytes) {
+    static const size_t min_log = floor_log2(MIN_BYTES);
+    bytes = std::max(bytes, MIN_BYTES);
+    const size_t octave = floor_log2(bytes);
+    const size_t step = size_t(1) << (octave - 2);
+    const size_t steps = (bytes + step - 1) / step;
+    bytes = steps * step;
+    return (octave - min_log) * 4 + (steps - 4);
+}
+
+
+inline std::align_val_t alignment(size_t capacity) {
+    return std::align_val_t(capacity >= HUGE_PAGE ? HUGE_PAGE : 64);
+}
+
+} // namespace detail
+
+
+class buffer_pool;
+
+
+/* A leased buffer, handed back to its pool when destroyed */
+class buffer {
+public:
+    buffer() = default;
+
+    buffer(buffer &&other) noexcept { swap(other); }
+
+    buffer &operator=(buffer &&other) noexcept {
+        buffer(std::move(other)).swap(*this);
+        return *this;
+    }
+
+    ~buffer();
+
+    buffer(const buffer &) = delete;
+    buffer &operator=(const buffer &) = delete;
+
+    std::uint8_t *data() const { return data_; }
+    char *chars() const { return reinterpret_cast<char *>(data_); }
+    size_t size() const { return size_; }
+
+    /* Shortens the buffer, e.g. to the length actually written, the capacity is kept */
+    void truncate(size_t bytes) { size_ = std::min(size_, bytes); }
+
+private:
+    friend class buffer_pool;
+
+    buffer(buffer_pool *owner, std::uint8_t *data, size_t size, size_t capacity)
+        : owner_(owner), data_(data), size_(size), capacity_(capacity) {}
+
+    void swap(buffer &other) noexcept {
+        std::swap(owner_, other.owner_);
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+        std::swap(capacity_, other.capacity_);
+    }
+
+    buffer_pool *owner_ = nullptr;
+    std::uint8_t *data_ = nullptr;
+    size_t size_ = 0;
+    size_t capacity_ = 0;
+};
+
+
+class buffer_pool {
+public:
+    buffer_pool() = default;
+
+    ~buffer_pool() { clear(); }
+
+    buffer_pool(const buffer_pool &) = delete;
+    buffer_pool &operator=(const buffer_pool &) = delete;
+
+    /* The process wide pool used by the load / convert / save paths */
+    static buffer_pool &global() {
+        static buffer_pool instance;
+        return instance;
+    }
+
+    /* A buffer of at least `bytes` bytes, contents undefined */
+    buffer acquire(size_t bytes) {
+        size_t capacity = bytes;
+        const size_t index = detail::size_class(capacity);
+        bool huge = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (index < free_.size() && !free_[index].empty()) {
+                std::uint8_t *ptr = free_[index].back();
+                free_[index].pop_back();
+                cached_bytes_ -= capacity;
+                hits_++;
+                return buffer(this, ptr, bytes, capacity);
+            }
+            misses_++;
+            huge = huge_pages_;
+        }
+
+        auto *ptr = static_cast<std::uint8_t *>(::operator new(capacity, detail::alignment(capacity)));
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+        if (huge && capacity >= HUGE_PAGE)
+            ::madvise(ptr, capacity, MADV_HUGEPAGE);
+#else
+        (void)huge;
+#endif
+        return buffer(this, ptr, bytes, capacity);
+    }
+
+    /* max_bytes = 0 disables caching, buffers are then freed as soon as they are returned */
+    void configure(size_t max_bytes, bool huge_pages) {
+        std::vector<std::vector<std::uint8_t *>> evicted;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            max_bytes_ = max_bytes;
+            huge_pages_ = huge_pages;
+            if (cached_bytes_ > max_bytes_) {
+                evicted.swap(free_);
+                cached_bytes_ = 0;
+            }
+        }
+        free_lists(evicted);
+    }
+
+    void clear() {
+        std::vector<std::vector<std::uint8_t *>> evicted;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            evicted.swap(free_);
+            cached_bytes_ = 0;
+        }
+        free_lists(evicted);
+    }
+
+    pool_stats stats() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pool_stats out;
+        out.cached_bytes = cached_bytes_;
+        for (const auto &list : free_)
+            out.cached_buffers += list.size();
+        out.hits = hits_;
+        out.misses = misses_;
+        out.max_bytes = max_bytes_;
+        out.huge_pages = huge_pages_;
+        return out;
+    }
+
+private:
+    friend class buffer;
+
+    void release(std::uint8_t *ptr, size_t capacity) {
+        size_t rounded = capacity;
+        const size_t index = detail::size_class(rounded);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (cached_bytes_ + capacity <= max_bytes_) {
+                if (free_.size() <= index)
+                    free_.resize(index + 1);
+                free_[index].push_back(ptr);
+                cached_bytes_ += capacity;
+                return;
+            }
+        }
+        ::operator delete(ptr, detail::alignment(capacity));
+    }
+
+    /* Frees every buffer of `lists`, whose capacity is implied by its class */
+    static void free_lists(const std::vector<std::vector<std::uint8_t *>> &lists) {
+        for (size_t index = 0; index < lists.size(); index++) {
+            const size_t octave = index / 4 + detail::floor_log2(MIN_BYTES);
+            const size_t capacity = (4 + index % 4) * (size_t(1) << (octave - 2));
+            for (std::uint8_t *ptr : lists[index])
+                ::operator delete(ptr, detail::alignment(capacity));
+        }
+    }
+
+    mutable std::mutex mutex_;
+    std::vector<std::vector<std::uint8_t *>> free_;
+    size_t cached_bytes_ = 0;
+    size_t hits_ = 0;
+    size_t misses_ = 0;
+    size_t max_bytes_ = DEFAULT_MAX_BYTES;
+    bool huge_pages_ = false;
+};
+
+
+inline buffer::~buffer() {
+    if (data_)
+        owner_->release(data_, capacity_);
+}
+
+
+/* Leases a buffer of at least `bytes` bytes from the global pool */
+inline buffer acquire(size_t bytes) {
+    return buffer_pool::global().acquire(bytes);
+}
+
+} // namespace pool
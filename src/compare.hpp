@@ -0,0 +1,395 @@
+#pragma once
+
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+
+#include "float_convert.hpp"
+#include "parallel.hpp"
+
+
+/*
+ * Image comparison metrics for encoder QA. Both images are read in place through strided
+ * views (a texture's storage or a NumPy buffer), so no float copy of either image is made.
+ * When both have the same element type and pack each row's elements together, rows are
+ * walked as flat typed arrays the compiler can vectorise; otherwise every element goes
+ * through its byte strides. Work is split into bands of rows across threads, each band
+ * keeps its own partial sums which are added up at the end.
+ *
+ * SSIM follows Wang et al. with a 7x7 uniform window, sample covariance and K1 = 0.01,
+ * K2 = 0.03 (the scikit-image defaults), averaged over every fully covered window.
+ */
+namespace compare {
+
+enum class element { u8, i8, u16, i16, u32, i32, u64, i64, f16, f32, f64 };
+
+
+/* NumPy style type code (kind 'u' / 'i' / 'f' and size in bytes) -> element */
+inline element element_type(char kind, size_t itemsize) {
+    if (kind == 'u') {
+        switch (itemsize) {
+            case 1: return element::u8;
+            case 2: return element::u16;
+            case 4: return element::u32;
+            case 8: return element::u64;
+        }
+    } else if (kind == 'i') {
+        switch (itemsize) {
+            case 1: return element::i8;
+            case 2: return element::i16;
+            case 4: return element::i32;
+            case 8: return element::i64;
+        }
+    } else if (kind == 'f') {
+        switch (itemsize) {
+            case 2: return element::f16;
+            case 4: return element::f32;
+            case 8: return element::f64;
+        }
+    }
+    throw std::invalid_argument("Unsupported dtype for compare");
+}
+
+
+/* [H,W,C] elements, strides in bytes */
+struct image_view {
+    const std::uint8_t *data = nullptr;
+    element type = element::u8;
+    size_t height = 0;
+    size_t width = 0;
+    size_t channels = 0;
+    std::ptrdiff_t row_stride = 0;
+    std::ptrdiff_t texel_stride = 0;
+    std::ptrdiff_t channel_stride = 0;
+};
+
+
+struct options {
+    bool mse = false;
+    bool psnr = false;
+    bool maxabs = false;
+    bool ssim = false;
+    double data_range = 0.0;    // 0 = the range of the element type, 1 for floats
+    size_t num_threads = 0;
+};
+
+
+/* Per-channel results, empty for metrics that weren't asked for */
+struct result {
+    std::vector<double> mse;
+    std::vector<double> psnr;
+    std::vector<double> maxabs;
+    std::vector<double> ssim;
+};
+
+
+namespace detail {
+
+constexpr size_t ERROR_BAND = 64;
+constexpr size_t SSIM_BAND = 32;
+constexpr size_t SSIM_WINDOW = 7;
+
+struct half_bits {};
+
+template <typename T>
+struct reader {
+    static double get(const std::uint8_t *p) {
+        T v;
+        std::memcpy(&v, p, sizeof(T));
+        return double(v);
+    }
+};
+
+template <>
+struct reader<half_bits> {
+    static double get(const std::uint8_t *p) {
+        std::uint16_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return double(half_to_float(v));
+    }
+};
+
+
+template <typename T>
+struct type_tag {
+    using type = T;
+};
+
+
+/* Calls f(type_tag<T>()) for the C++ type read for `type` */
+template <typename F>
+auto visit(element type, F &&f) {
+    switch (type) {
+        case element::u8: return f(type_tag<std::uint8_t>());
+        case element::i8: return f(type_tag<std::int8_t>());
+        case element::u16: return f(type_tag<std::uint16_t>());
+        case element::i16: return f(type_tag<std::int16_t>());
+        case element::u32: return f(type_tag<std::uint32_t>());
+        case element::i32: return f(type_tag<std::int32_t>());
+        case element::u64: return f(type_tag<std::uint64_t>());
+        case element::i64: return f(type_tag<std::int64_t>());
+        case element::f16: return f(type_tag<half_bits>());
+        case element::f32: return f(type_tag<float>());
+        default: return f(type_tag<double>());
+    }
+}
+
+
+/* max() in which a NaN, once seen, sticks */
+inline double max_nan(double m, double v) {
+    return (m != m || v <= m) ? m : v;
+}
+
+
+template <typename T>
+double type_range() {
+    if constexpr (std::is_integral<T>::value)
+        return double(std::numeric_limits<T>::max()) - double(std::numeric_limits<T>::lowest());
+    else
+        return 1.0;
+}
+
+
+template <typename TA, typename TB>
+class comparer {
+public:
+    comparer(const image_view &a, const image_view &b)
+        : a_(a), b_(b), channels_(a.channels), flat_(FLAT && packed(a, sizeof(TA), alignof(TA)) && packed(b, sizeof(TB), alignof(TB))) {}
+
+    double va(size_t y, size_t x, size_t c) const {
+        return reader<TA>::get(a_.data + std::ptrdiff_t(y) * a_.row_stride + std::ptrdiff_t(x) * a_.texel_stride + std::ptrdiff_t(c) * a_.channel_stride);
+    }
+
+    double vb(size_t y, size_t x, size_t c) const {
+        return reader<TB>::get(b_.data + std::ptrdiff_t(y) * b_.row_stride + std::ptrdiff_t(x) * b_.texel_stride + std::ptrdiff_t(c) * b_.channel_stride);
+    }
+
+    /* Sum of squared errors and max |error| per channel. NaN errors stick in maxabs */
+    void errors(size_t num_threads, std::vector<double> &sse, std::vector<double> &maxabs) const {
+        const size_t bands = (a_.height + ERROR_BAND - 1) / ERROR_BAND;
+        std::vector<double> band_sse(bands * channels_, 0.0);
+        std::vector<double> band_max(bands * channels_, 0.0);
+        parallel_for(bands, num_threads, [&](size_t band) {
+            double *sq = band_sse.data() + band * channels_;
+            double *mx = band_max.data() + band * channels_;
+            const size_t begin = band * ERROR_BAND;
+            const size_t end = std::min(a_.height, begin + ERROR_BAND);
+            if constexpr (FLAT) {
+                if (flat_) {
+                    flat_errors(begin, end, sq, mx);
+                    return;
+                }
+            }
+            for (size_t y = begin; y < end; y++)
+                for (size_t x = 0; x < a_.width; x++)
+                    for (size_t c = 0; c < channels_; c++) {
+                        const double d = va(y, x, c) - vb(y, x, c);
+                        sq[c] += d * d;
+                        mx[c] = max_nan(mx[c], std::abs(d));
+                    }
+        });
+
+        sse.assign(channels_, 0.0);
+        maxabs.assign(channels_, 0.0);
+        for (size_t band = 0; band < bands; band++)
+            for (size_t c = 0; c < channels_; c++) {
+                sse[c] += band_sse[band * channels_ + c];
+                maxabs[c] = max_nan(maxabs[c], band_max[band * channels_ + c]);
+            }
+    }
+
+    /*
+     * Mean SSIM per channel. Each band slides the window down its rows keeping column sums of
+     * a, b, a^2, b^2 and ab, then slides it across each row over those sums.
+     */
+    std::vector<double> ssim(double data_range, size_t num_threads) const {
+        const size_t n = SSIM_WINDOW;
+        const size_t out_h = a_.height - n + 1;
+        const size_t out_w = a_.width - n + 1;
+        const size_t row = a_.width * channels_;
+        const double count = double(n * n);
+        const double cov_norm = count / (count - 1.0);
+        const double c1 = (0.01 * data_range) * (0.01 * data_range);
+        const double c2 = (0.03 * data_range) * (0.03 * data_range);
+
+        const size_t bands = (out_h + SSIM_BAND - 1) / SSIM_BAND;
+        std::vector<double> band_sum(bands * channels_, 0.0);
+        parallel_for(bands, num_threads, [&](size_t band) {
+            std::vector<double> cols(5 * row, 0.0);
+            double *sa = cols.data(), *sb = sa + row, *saa = sb + row, *sbb = saa + row, *sab = sbb + row;
+            auto add_row = [&](size_t y, double sign) {
+                if constexpr (FLAT) {
+                    if (flat_) {
+                        // Column sums are indexed x * channels + c, the packed rows' own order
+                        const TA *ra = row_a(y);
+                        const TB *rb = row_b(y);
+                        for (size_t i = 0; i < row; i++) {
+                            const double u = double(ra[i]), v = double(rb[i]);
+                            sa[i] += sign * u;
+                            sb[i] += sign * v;
+                            saa[i] += sign * u * u;
+                            sbb[i] += sign * v * v;
+                            sab[i] += sign * u * v;
+                        }
+                        return;
+                    }
+                }
+                for (size_t x = 0; x < a_.width; x++)
+                    for (size_t c = 0; c < channels_; c++) {
+                        const double u = va(y, x, c), v = vb(y, x, c);
+                        const size_t i = x * channels_ + c;
+                        sa[i] += sign * u;
+                        sb[i] += sign * v;
+                        saa[i] += sign * u * u;
+                        sbb[i] += sign * v * v;
+                        sab[i] += sign * u * v;
+                    }
+            };
+
+            const size_t begin = band * SSIM_BAND;
+            const size_t end = std::min(out_h, begin + SSIM_BAND);
+            for (size_t y = begin; y < begin + n; y++)
+                add_row(y, 1.0);
+
+            double *total = band_sum.data() + band * channels_;
+            for (size_t y = begin; y < end; y++) {
+                if (y > begin) {
+                    add_row(y + n - 1, 1.0);
+                    add_row(y - 1, -1.0);
+                }
+                for (size_t c = 0; c < channels_; c++) {
+                    double w[5] = {};
+                    for (size_t x = 0; x < n; x++) {
+                        const size_t i = x * channels_ + c;
+                        w[0] += sa[i]; w[1] += sb[i]; w[2] += saa[i]; w[3] += sbb[i]; w[4] += sab[i];
+                    }
+                    for (size_t x = 0; x < out_w; x++) {
+                        if (x > 0) {
+                            const size_t in = (x + n - 1) * channels_ + c, out = (x - 1) * channels_ + c;
+                            w[0] += sa[in] - sa[out];
+                            w[1] += sb[in] - sb[out];
+                            w[2] += saa[in] - saa[out];
+                            w[3] += sbb[in] - sbb[out];
+                            w[4] += sab[in] - sab[out];
+                        }
+                        const double mu_a = w[0] / count, mu_b = w[1] / count;
+                        const double var_a = (w[2] / count - mu_a * mu_a) * cov_norm;
+                        const double var_b = (w[3] / count - mu_b * mu_b) * cov_norm;
+                        const double cov = (w[4] / count - mu_a * mu_b) * cov_norm;
+                        total[c] += ((2.0 * mu_a * mu_b + c1) * (2.0 * cov + c2))
+                                  / ((mu_a * mu_a + mu_b * mu_b + c1) * (var_a + var_b + c2));
+                    }
+                }
+            }
+        });
+
+        std::vector<double> out(channels_, 0.0);
+        for (size_t band = 0; band < bands; band++)
+            for (size_t c = 0; c < channels_; c++)
+                out[c] += band_sum[band * channels_ + c];
+        for (auto &v : out)
+            v /= double(out_h * out_w);
+        return out;
+    }
+
+private:
+    /* Flat typed loops need one native element type on both sides */
+    static constexpr bool FLAT = std::is_same<TA, TB>::value && std::is_arithmetic<TA>::value;
+
+    /* Each row's elements are adjacent and aligned, so a row can be read as a T array */
+    static bool packed(const image_view &v, size_t size, size_t align) {
+        return (v.channels == 1 || v.channel_stride == std::ptrdiff_t(size)) && v.texel_stride == std::ptrdiff_t(v.channels * size)
+            && reinterpret_cast<std::uintptr_t>(v.data) % align == 0 && size_t(std::abs(v.row_stride)) % align == 0;
+    }
+
+    const TA *row_a(size_t y) const { return reinterpret_cast<const TA *>(a_.data + std::ptrdiff_t(y) * a_.row_stride); }
+    const TB *row_b(size_t y) const { return reinterpret_cast<const TB *>(b_.data + std::ptrdiff_t(y) * b_.row_stride); }
+
+    /*
+     * errors() over rows [begin, end) of packed images: squared errors and max |error| are
+     * kept per element of a row, then folded into channels once for the band.
+     */
+    void flat_errors(size_t begin, size_t end, double *sq, double *mx) const {
+        const size_t n = a_.width * channels_;
+        std::vector<double> row_sq(n, 0.0), row_max(n, 0.0);
+        for (size_t y = begin; y < end; y++) {
+            const TA *ra = row_a(y);
+            const TB *rb = row_b(y);
+            for (size_t i = 0; i < n; i++) {
+                const double d = double(ra[i]) - double(rb[i]);
+                row_sq[i] += d * d;
+                row_max[i] = max_nan(row_max[i], std::abs(d));
+            }
+        }
+        for (size_t i = 0; i < n; i++) {
+            sq[i % channels_] += row_sq[i];
+            mx[i % channels_] = max_nan(mx[i % channels_], row_max[i]);
+        }
+    }
+
+    image_view a_;
+    image_view b_;
+    size_t channels_;
+    bool flat_;
+};
+
+
+template <typename TA, typename TB>
+result run(const image_view &a, const image_view &b, const options &opts) {
+    const comparer<TA, TB> cmp(a, b);
+    const double range = opts.data_range > 0.0 ? opts.data_range : type_range<TA>();
+    const double pixels = double(a.height * a.width);
+    result out;
+
+    if (opts.mse || opts.psnr || opts.maxabs) {
+        std::vector<double> sse, maxabs;
+        cmp.errors(opts.num_threads, sse, maxabs);
+        for (double &v : sse)
+            v /= pixels;
+        if (opts.psnr)
+            for (double mse : sse)
+                out.psnr.push_back(mse > 0.0 ? 10.0 * std::log10(range * range / mse) : std::numeric_limits<double>::infinity());
+        if (opts.mse)
+            out.mse = std::move(sse);
+        if (opts.maxabs)
+            out.maxabs = std::move(maxabs);
+    }
+    if (opts.ssim)
+        out.ssim = cmp.ssim(range, opts.num_threads);
+    return out;
+}
+
+} // namespace detail
+
+
+/*
+ * Compares two images of the same shape and element type. A float16 image may also be
+ * compared with a float32 one, e.g. a half texture file against a loaded array.
+ */
+inline result compare(const image_view &a, const image_view &b, const options &opts) {
+    if (a.height != b.height || a.width != b.width || a.channels != b.channels)
+        throw std::invalid_argument("Images differ in shape");
+    if (a.height == 0 || a.width == 0 || a.channels == 0)
+        throw std::invalid_argument("Images are empty");
+    if (opts.ssim && (a.height < detail::SSIM_WINDOW || a.width < detail::SSIM_WINDOW))
+        throw std::invalid_argument("SSIM needs images of at least 7x7");
+
+    if (a.type == b.type)
+        return detail::visit(a.type, [&](auto tag) {
+            using T = typename decltype(tag)::type;
+            return detail::run<T, T>(a, b, opts);
+        });
+    if (a.type == element::f16 && b.type == element::f32)
+        return detail::run<detail::half_bits, float>(a, b, opts);
+    if (a.type == element::f32 && b.type == element::f16)
+        return detail::run<float, detail::half_bits>(a, b, opts);
+    throw std::invalid_argument("Images differ in dtype");
+}
+
+} // namespace compare
@@ -0,0 +1,367 @@
+/*
+ * pygli-convert: bulk transcoding of texture files without going through Python.
+ *
+ *   pygli-convert [options] INPUT...
+ *
+ * INPUTs are files or glob patterns (*, ? and ** for any number of directories). Each file
+ * is pushed through read -> decode -> encode -> write as separate tasks on a work-stealing
+ * pool, so one file's IO overlaps with other files' decode / encode. Outputs that are newer
+ * than their input are skipped.
+ */
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <map>
+#include <set>
+#include <fstream>
+#include <iostream>
+#include <filesystem>
+#include <system_error>
+
+#include <gli/gli.hpp>
+
+#include "texture_io.hpp"
+#include "work_stealing.hpp"
+
+namespace fs = std::filesystem;
+
+
+static const char *USAGE =
+    "usage: pygli-convert [options] INPUT...\n"
+    "\n"
+    "Converts texture files (DDS, KTX, KMG, KTX2, PNG, TGA, JPEG, HDR, ...) to another container.\n"
+    "INPUT may be a file or a glob pattern, '**' matches any number of directories.\n"
+    "\n"
+    "options:\n"
+    "  -o, --output DIR       write outputs under DIR, mirroring the input tree (default: next to the input)\n"
+    "  -e, --ext EXT          output container, .ktx2 / .dds / .ktx / .kmg (default: .ktx2)\n"
+    "  -m, --manifest FILE    read inputs from FILE, one path or pattern per line\n"
+    "  -r, --root DIR         directory the mirrored output tree is relative to\n"
+    "                         (default: the fixed prefix of each pattern, or the manifest's directory)\n"
+    "  -j, --threads N        worker threads (default: one per core)\n"
+    "  -z, --zstd-level N     Zstandard level for .ktx2 outputs, 0 disables supercompression (default: 3)\n"
+    "  -f, --force            convert even when the output is up to date\n"
+    "  -q, --quiet            only report errors and the final summary\n"
+    "  -h, --help             show this message\n";
+
+
+struct options {
+    std::vector<std::string> inputs;
+    std::string manifest;
+    std::string output;
+    std::string root;
+    std::string ext = ".ktx2";
+    size_t threads = 0;
+    int zstd_level = 3;
+    bool force = false;
+    bool quiet = false;
+};
+
+
+struct job {
+    size_t index = 0;
+    fs::path input;
+    fs::path output;
+    std::vector<char> bytes;
+    gli::texture texture;
+};
+
+
+struct totals {
+    std::atomic<size_t> converted{0};
+    std::atomic<size_t> skipped{0};
+    std::atomic<size_t> failed{0};
+    std::atomic<size_t> bytes_in{0};
+    std::atomic<size_t> bytes_out{0};
+};
+
+
+/* Matches one path component against a pattern of '*' and '?' wildcards */
+static bool match_component(const char *pattern, const char *name) {
+    for (; *pattern; pattern++, name++) {
+        if (*pattern == '*') {
+            for (const char *rest = name;; rest++) {
+                if (match_component(pattern + 1, rest))
+                    return true;
+                if (!*rest)
+                    return false;
+            }
+        }
+        if (!*name || (*pattern != '?' && *pattern != *name))
+            return false;
+    }
+    return !*name;
+}
+
+
+static bool match_path(const std::vector<std::string> &pattern, size_t p, const std::vector<std::string> &path, size_t n) {
+    if (p == pattern.size())
+        return n == path.size();
+    if (pattern[p] == "**") {
+        for (size_t skip = n; skip <= path.size(); skip++)
+            if (match_path(pattern, p + 1, path, skip))
+                return true;
+        return false;
+    }
+    return n < path.size() && match_component(pattern[p].c_str(), path[n].c_str())
+        && match_path(pattern, p + 1, path, n + 1);
+}
+
+
+static bool has_wildcard(const std::string &s) {
+    return s.find_first_of("*?") != std::string::npos;
+}
+
+
+static std::vector<std::string> components(const fs::path &path) {
+    std::vector<std::string> out;
+    for (const auto &part : path)
+        if (!part.empty() && part != ".")
+            out.push_back(part.string());
+    return out;
+}
+
+
+/* Expands a file or glob pattern, appending (input, root) pairs */
+static void expand(const std::string &pattern, const fs::path &relative_to, std::vector<std::pair<fs::path, fs::path>> &out) {
+    fs::path path(pattern);
+    if (path.is_relative())
+        path = relative_to / path;
+
+    // Split into the fixed leading directory and the wildcard part
+    fs::path base;
+    fs::path rest;
+    bool wild = false;
+    for (const auto &part : path) {
+        if (!wild && has_wildcard(part.string()))
+            wild = true;
+        (wild ? rest : base) /= part;
+    }
+
+    if (!wild) {
+        if (!fs::is_regular_file(path))
+            throw std::invalid_argument("File doesn't exist: " + path.string());
+        out.emplace_back(path, path.parent_path());
+        return;
+    }
+
+    const std::vector<std::string> pattern_parts = components(rest);
+    std::error_code ec;
+    for (fs::recursive_directory_iterator it(base, fs::directory_options::skip_permission_denied, ec), end; it != end; it.increment(ec)) {
+        if (ec)
+            break;
+        if (it->is_regular_file(ec) && match_path(pattern_parts, 0, components(it->path().lexically_relative(base)), 0))
+            out.emplace_back(it->path(), base);
+    }
+}
+
+
+static fs::path output_path(const fs::path &input, const fs::path &root, const options &opts) {
+    fs::path out = opts.output.empty() ? input : fs::path(opts.output) / input.lexically_relative(root);
+    out.replace_extension(opts.ext);
+    return out;
+}
+
+
+static bool up_to_date(const fs::path &input, const fs::path &output) {
+    std::error_code ec;
+    const auto out_time = fs::last_write_time(output, ec);
+    if (ec)
+        return false;
+    return out_time >= fs::last_write_time(input);
+}
+
+
+/* Writes through a temporary file, unique to job `index`, so an interrupted bake never leaves a truncated output */
+static void write_file(const fs::path &path, const std::vector<char> &data, size_t index) {
+    if (path.has_parent_path())
+        fs::create_directories(path.parent_path());
+    fs::path tmp = path;
+    tmp += "." + std::to_string(index) + ".tmp";
+    {
+        std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+        file.write(data.data(), data.size());
+        if (!file.good())
+            throw std::runtime_error("Failed to write: " + tmp.string());
+    }
+    fs::rename(tmp, path);
+}
+
+
+static bool parse_args(int argc, char **argv, options &opts) {
+    auto value = [&](int &i) -> std::string {
+        if (i + 1 >= argc)
+            throw std::invalid_argument(std::string("Missing value for ") + argv[i]);
+        return argv[++i];
+    };
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "-h" || arg == "--help") {
+            std::cout << USAGE;
+            return false;
+        } else if (arg == "-o" || arg == "--output") {
+            opts.output = value(i);
+        } else if (arg == "-e" || arg == "--ext") {
+            opts.ext = value(i);
+            if (opts.ext.empty() || opts.ext[0] != '.')
+                opts.ext = "." + opts.ext;
+        } else if (arg == "-m" || arg == "--manifest") {
+            opts.manifest = value(i);
+        } else if (arg == "-r" || arg == "--root") {
+            opts.root = value(i);
+        } else if (arg == "-j" || arg == "--threads") {
+            opts.threads = std::stoul(value(i));
+        } else if (arg == "-z" || arg == "--zstd-level") {
+            opts.zstd_level = std::stoi(value(i));
+        } else if (arg == "-f" || arg == "--force") {
+            opts.force = true;
+        } else if (arg == "-q" || arg == "--quiet") {
+            opts.quiet = true;
+        } else if (arg.size() > 1 && arg[0] == '-') {
+            throw std::invalid_argument("Unknown option: " + arg);
+        } else {
+            opts.inputs.push_back(arg);
+        }
+    }
+    if (opts.inputs.empty() && opts.manifest.empty())
+        throw std::invalid_argument("No inputs given");
+    if (!has_extension(opts.ext, ".ktx2") && !has_extension(opts.ext, ".dds")
+        && !has_extension(opts.ext, ".ktx") && !has_extension(opts.ext, ".kmg"))
+        throw std::invalid_argument("Unsupported output extension: " + opts.ext);
+    return true;
+}
+
+
+int main(int argc, char **argv) {
+    options opts;
+    std::vector<std::pair<fs::path, fs::path>> files;
+    try {
+        if (!parse_args(argc, argv, opts))
+            return 0;
+        for (const auto &input : opts.inputs)
+            expand(input, fs::path(), files);
+        if (!opts.manifest.empty()) {
+            std::ifstream manifest(opts.manifest);
+            if (!manifest.good())
+                throw std::invalid_argument("File doesn't exist: " + opts.manifest);
+            const fs::path manifest_dir = fs::path(opts.manifest).parent_path();
+            for (std::string line; std::getline(manifest, line);) {
+                line.erase(line.find_last_not_of(" \t\r") + 1);
+                if (line.empty() || line[0] == '#')
+                    continue;
+                expand(line, manifest_dir, files);
+                // Plain paths keep their directories under --output, relative to the manifest
+                if (!has_wildcard(line))
+                    files.back().second = manifest_dir;
+            }
+        }
+    } catch (const std::exception &e) {
+        std::cerr << "pygli-convert: " << e.what() << "\n\n" << USAGE;
+        return 2;
+    }
+
+    totals total;
+    std::mutex log_mutex;
+    auto fail = [&](const job &j, const std::exception &e) {
+        total.failed++;
+        std::lock_guard<std::mutex> lock(log_mutex);
+        std::cerr << "error: " << j.input.string() << ": " << e.what() << "\n";
+    };
+
+    // A file matched twice is converted once. Distinct inputs that map to one output (a.png and
+    // a.dds -> a.ktx2) would overwrite each other, so none of them is converted
+    std::vector<std::shared_ptr<job>> jobs;
+    std::map<fs::path, std::vector<size_t>> writers;
+    std::set<fs::path> seen;
+    for (const auto &file : files) {
+        if (!seen.insert(file.first.lexically_normal()).second)
+            continue;
+        auto j = std::make_shared<job>();
+        j->index = jobs.size();
+        j->input = file.first;
+        j->output = output_path(file.first, opts.root.empty() ? file.second : fs::path(opts.root), opts);
+        writers[j->output.lexically_normal()].push_back(j->index);
+        jobs.push_back(j);
+    }
+    for (const auto &writer : writers) {
+        if (writer.second.size() < 2)
+            continue;
+        for (size_t index : writer.second) {
+            fail(*jobs[index], std::invalid_argument("Output " + writer.first.string() + " is written by " + std::to_string(writer.second.size())
+                                                     + " inputs, rename one or use a different --ext"));
+            jobs[index] = nullptr;
+        }
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    {
+        work_stealing_pool pool(opts.threads);
+
+        // Each stage hands its job to the next by submitting it, workers keep a file's
+        // later stages on their own deque while idle workers steal whole new files.
+        for (const auto &j : jobs) {
+            if (!j)
+                continue;
+            pool.submit([&, j]() {
+                try {
+                    if (j->output == j->input)
+                        throw std::invalid_argument("Output would overwrite input, use --output or a different --ext");
+                    if (!opts.force && up_to_date(j->input, j->output)) {
+                        total.skipped++;
+                        return;
+                    }
+                    j->bytes = read_file(j->input.string());
+                    total.bytes_in += j->bytes.size();
+                } catch (const std::exception &e) {
+                    return fail(*j, e);
+                }
+
+                pool.submit([&, j]() {
+                    try {
+                        j->texture = decode_texture(std::move(j->bytes), j->input.string(), 1);
+                        j->bytes = std::vector<char>();
+                    } catch (const std::exception &e) {
+                        return fail(*j, e);
+                    }
+
+                    pool.submit([&, j]() {
+                        try {
+                            j->bytes = encode_texture(j->texture, j->output.string(), opts.zstd_level, 1);
+                            j->texture = gli::texture();
+                        } catch (const std::exception &e) {
+                            return fail(*j, e);
+                        }
+
+                        pool.submit([&, j]() {
+                            try {
+                                write_file(j->output, j->bytes, j->index);
+                                total.bytes_out += j->bytes.size();
+                                total.converted++;
+                                if (!opts.quiet) {
+                                    std::lock_guard<std::mutex> lock(log_mutex);
+                                    std::cout << j->input.string() << " -> " << j->output.string() << "\n";
+                                }
+                            } catch (const std::exception &e) {
+                                return fail(*j, e);
+                            }
+                        });
+                    });
+                });
+            });
+        }
+        pool.wait();
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    const double mb = 1024.0 * 1024.0;
+    const double elapsed = std::max(seconds, 1e-9);
+    std::printf("%zu converted, %zu up to date, %zu failed in %.2fs: %.1f files/s, %.1f MB/s in, %.1f MB/s out\n",
+        total.converted.load(), total.skipped.load(), total.failed.load(), seconds,
+        total.converted / elapsed, total.bytes_in / mb / elapsed, total.bytes_out / mb / elapsed);
+    return total.failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <gli/gli.hpp>
+
+#include "texture_header.hpp"
+
+
+/*
+ * In-place edits of part of an existing DDS file. The header is parsed to locate the image
+ * (DDS stores each layer's faces as full mip chains, one after another) and only the rows of
+ * texels or blocks covering the edited region are written, with positional writes, so the
+ * cost follows the size of the edit rather than of the file.
+ */
+namespace dds {
+
+/* Texels, x / y / width / height must line up with blocks for compressed formats */
+struct region {
+    size_t x = 0;
+    size_t y = 0;
+    size_t width = 0;
+    size_t height = 0;
+};
+
+
+/* Where a DDS file keeps each image's texel data */
+class file_layout {
+public:
+    explicit file_layout(const std::string &filepath) {
+        std::ifstream file(filepath, std::ios::binary | std::ios::ate);
+        if (!file.good())
+            throw std::invalid_argument("File doesn't exist: " + filepath);
+        const size_t file_size = size_t(file.tellg());
+
+        detail::dds_header raw;
+        file.seekg(0);
+        if (!file.read(reinterpret_cast<char *>(&raw), sizeof(raw)) || raw.magic != detail::DDS_MAGIC || raw.size != sizeof(raw) - sizeof(raw.magic))
+            throw std::invalid_argument("Not a DDS file: " + filepath);
+        if (!detail::read_dds_header(file, header_))
+            throw std::invalid_argument("DDS pixel format can't be updated in place (unknown): " + filepath);
+        if (header_.extent.z > 1)
+            throw std::invalid_argument("Volume textures can't be updated in place: " + filepath);
+
+        // Legacy mask formats (what gli writes for RGBA8, R8, ...) have no DX10 header to skip
+        const auto four_cc = static_cast<gli::dx::d3dfmt>(raw.pf_four_cc);
+        const bool dx10 = (raw.pf_flags & detail::DDPF_FOURCC) && (four_cc == gli::dx::D3DFMT_DX10 || four_cc == gli::dx::D3DFMT_GLI1);
+        data_offset_ = sizeof(raw) + (dx10 ? sizeof(detail::dds_header10) : 0);
+        const gli::extent3d block = gli::block_extent(header_.format);
+        block_width_ = size_t(block.x);
+        block_height_ = size_t(block.y);
+        block_size_ = gli::block_size(header_.format);
+        for (size_t level = 0; level < header_.levels; level++)
+            chain_bytes_ += level_bytes(level);
+
+        if (data_offset_ + chain_bytes_ * header_.layers * header_.faces > file_size)
+            throw std::invalid_argument("DDS file is shorter than its header describes: " + filepath);
+    }
+
+    const texture_header &header() const { return header_; }
+    size_t block_width() const { return block_width_; }
+    size_t block_height() const { return block_height_; }
+    size_t block_size() const { return block_size_; }
+
+    size_t level_width(size_t level) const { return std::max<size_t>(size_t(header_.extent.x) >> level, 1); }
+    size_t level_height(size_t level) const { return std::max<size_t>(size_t(header_.extent.y) >> level, 1); }
+
+    /* Bytes of one row of blocks */
+    size_t pitch(size_t level) const { return (level_width(level) + block_width_ - 1) / block_width_ * block_size_; }
+
+    size_t level_bytes(size_t level) const { return pitch(level) * ((level_height(level) + block_height_ - 1) / block_height_); }
+
+    /* File offset of an image's first byte */
+    size_t image_offset(size_t layer, size_t face, size_t level) const {
+        size_t out = data_offset_ + (layer * header_.faces + face) * chain_bytes_;
+        for (size_t l = 0; l < level; l++)
+            out += level_bytes(l);
+        return out;
+    }
+
+private:
+    texture_header header_;
+    size_t data_offset_ = 0;
+    size_t block_width_ = 1;
+    size_t block_height_ = 1;
+    size_t block_size_ = 0;
+    size_t chain_bytes_ = 0;    // one face's full mip chain
+};
+
+
+/* A file opened for positional writes, without truncating it */
+class writer {
+public:
+    explicit writer(const std::string &filepath) : filepath_(filepath) {
+#ifdef _WIN32
+        file_ = CreateFileA(filepath.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file_ == INVALID_HANDLE_VALUE)
+            throw std::runtime_error("Failed to open for writing: " + filepath);
+#else
+        fd_ = ::open(filepath.c_str(), O_WRONLY);
+        if (fd_ < 0)
+            throw std::runtime_error("Failed to open for writing: " + filepath);
+#endif
+    }
+
+    ~writer() {
+#ifdef _WIN32
+        CloseHandle(file_);
+#else
+        ::close(fd_);
+#endif
+    }
+
+    writer(const writer &) = delete;
+    writer &operator=(const writer &) = delete;
+
+    void write_at(size_t offset, const std::uint8_t *data, size_t size) {
+        while (size > 0) {
+#ifdef _WIN32
+            OVERLAPPED at = {};
+            at.Offset = DWORD(offset & 0xFFFFFFFFu);
+            at.OffsetHigh = DWORD(std::uint64_t(offset) >> 32);
+            DWORD written = 0;
+            const DWORD chunk = DWORD(std::min<size_t>(size, 1u << 30));
+            if (!WriteFile(file_, data, chunk, &written, &at) || written == 0)
+                throw std::runtime_error("Failed to write: " + filepath_);
+#else
+            const ssize_t written = ::pwrite(fd_, data, size, off_t(offset));
+            if (written < 0 && errno == EINTR)
+                continue;
+            if (written <= 0)
+                throw std::runtime_error("Failed to write: " + filepath_);
+#endif
+            offset += size_t(written);
+            data += written;
+            size -= size_t(written);
+        }
+    }
+
+private:
+    std::string filepath_;
+#ifdef _WIN32
+    HANDLE file_ = INVALID_HANDLE_VALUE;
+#else
+    int fd_ = -1;
+#endif
+};
+
+
+/*
+ * Overwrites `area` of one image with packed rows of blocks, `src_pitch` bytes apart. Rows that
+ * span the whole level are contiguous in the file and written together. Returns bytes written.
+ */
+inline size_t write_region(const std::string &filepath, const file_layout &layout, size_t layer, size_t face, size_t level,
+                           const region &area, const std::uint8_t *src, size_t src_pitch) {
+    const size_t first_row = area.y / layout.block_height();
+    const size_t rows = (area.height + layout.block_height() - 1) / layout.block_height();
+    const size_t row_bytes = (area.width + layout.block_width() - 1) / layout.block_width() * layout.block_size();
+    const size_t pitch = layout.pitch(level);
+    const size_t offset = layout.image_offset(layer, face, level) + first_row * pitch + area.x / layout.block_width() * layout.block_size();
+
+    writer file(filepath);
+    if (row_bytes == pitch && src_pitch == pitch) {
+        file.write_at(offset, src, rows * pitch);
+    } else {
+        for (size_t row = 0; row < rows; row++)
+            file.write_at(offset + row * pitch, src + row * src_pitch, row_bytes);
+    }
+    return rows * row_bytes;
+}
+
+} // namespace dds
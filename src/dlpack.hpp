@@ -0,0 +1,125 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+
+#include "buffer_pool.hpp"
+
+
+/*
+ * The DLPack tensor ABI (https://github.com/dmlc/dlpack, the legacy DLManagedTensor that
+ * "dltensor" capsules carry), declared here rather than vendoring dlpack.h since only these
+ * structs and the type codes are needed. The layouts must not change.
+ */
+namespace dlpack {
+
+enum device_type : std::int32_t {
+    kDLCPU = 1,
+    kDLCUDAHost = 3,
+};
+
+enum type_code : std::uint8_t {
+    kDLInt = 0,
+    kDLUInt = 1,
+    kDLFloat = 2,
+    kDLBool = 6,
+};
+
+struct DLDevice {
+    std::int32_t device_type;
+    std::int32_t device_id;
+};
+
+struct DLDataType {
+    std::uint8_t code;
+    std::uint8_t bits;
+    std::uint16_t lanes;
+};
+
+struct DLTensor {
+    void *data;
+    DLDevice device;
+    std::int32_t ndim;
+    DLDataType dtype;
+    std::int64_t *shape;
+    std::int64_t *strides;      // in elements, null for C-contiguous
+    std::uint64_t byte_offset;
+};
+
+struct DLManagedTensor {
+    DLTensor dl_tensor;
+    void *manager_ctx;
+    void (*deleter)(DLManagedTensor *self);
+};
+
+
+/* NumPy buffer format (as in format_traits::dtype) -> DLPack type */
+inline DLDataType dtype_of(const std::string &format) {
+    if (format.size() == 1) {
+        switch (format[0]) {
+            case 'B': return {kDLUInt, 8, 1};
+            case 'b': return {kDLInt, 8, 1};
+            case 'H': return {kDLUInt, 16, 1};
+            case 'h': return {kDLInt, 16, 1};
+            case 'I': return {kDLUInt, 32, 1};
+            case 'i': return {kDLInt, 32, 1};
+            case 'Q': return {kDLUInt, 64, 1};
+            case 'q': return {kDLInt, 64, 1};
+            case 'e': return {kDLFloat, 16, 1};
+            case 'f': return {kDLFloat, 32, 1};
+            case 'd': return {kDLFloat, 64, 1};
+        }
+    }
+    throw std::invalid_argument("No DLPack type for buffer format: " + format);
+}
+
+
+/* DLPack type -> NumPy buffer format */
+inline std::string buffer_format_of(const DLDataType &dtype) {
+    if (dtype.lanes == 1) {
+        switch (dtype.code) {
+            case kDLUInt:
+                switch (dtype.bits) { case 8: return "B"; case 16: return "H"; case 32: return "I"; case 64: return "Q"; }
+                break;
+            case kDLInt:
+                switch (dtype.bits) { case 8: return "b"; case 16: return "h"; case 32: return "i"; case 64: return "q"; }
+                break;
+            case kDLFloat:
+                switch (dtype.bits) { case 16: return "e"; case 32: return "f"; case 64: return "d"; }
+                break;
+            case kDLBool:
+                if (dtype.bits == 8)
+                    return "?";
+                break;
+        }
+    }
+    throw std::invalid_argument("Unsupported DLPack dtype (code " + std::to_string(dtype.code) + ", "
+                                + std::to_string(dtype.bits) + " bits, " + std::to_string(dtype.lanes) + " lanes)");
+}
+
+
+/* A C-contiguous CPU tensor over a pooled buffer, which its deleter hands back */
+inline DLManagedTensor *wrap(pool::buffer &&data, const std::vector<size_t> &shape, DLDataType dtype) {
+    struct context {
+        DLManagedTensor tensor;
+        pool::buffer data;
+        std::vector<std::int64_t> shape;
+    };
+    auto *ctx = new context{{}, std::move(data), std::vector<std::int64_t>(shape.begin(), shape.end())};
+    DLTensor &t = ctx->tensor.dl_tensor;
+    t.data = ctx->data.data();
+    t.device = {kDLCPU, 0};
+    t.ndim = std::int32_t(ctx->shape.size());
+    t.dtype = dtype;
+    t.shape = ctx->shape.data();
+    t.strides = nullptr;
+    t.byte_offset = 0;
+    ctx->tensor.manager_ctx = ctx;
+    ctx->tensor.deleter = [](DLManagedTensor *self) { delete static_cast<context *>(self->manager_ctx); };
+    return &ctx->tensor;
+}
+
+} // namespace dlpack
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 
 union Fp32
@@ -30,6 +31,12 @@ inline float half_to_float(std::uint16_t value) {
 }
 
 
+inline void half_to_float(const std::uint16_t *in, float *out, std::size_t count) {
+    for (std::size_t i = 0; i < count; i++)
+        out[i] = half_to_float(in[i]);
+}
+
+
 inline std::uint16_t float_to_half(float value) {
     /*
      * https://gist.github.com/rygorous/2156668
@@ -0,0 +1,339 @@
+#pragma once
+
+#include <array>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <gli/gli.hpp>
+
+#include "float_convert.hpp"
+#include "transpose.hpp"
+#include "resize.hpp"
+#include "stats.hpp"
+
+
+/*
+ * One constexpr table describes every texel format pygli can move between gli storage and
+ * NumPy: the element type presented to NumPy, the channel count, and the load / save /
+ * resize / stats kernels instantiated for that element type and channel count. load() and save() both
+ * look formats up here, so a new format is one table entry.
+ */
+
+/* Texture storage -> NumPy, interleaved (HWC) or planar (CHW) */
+using load_kernel = void (*)(const void *src, void *dst, size_t pixels, bool planar);
+
+/* One [H,W,C] image of a strided NumPy buffer (channels contiguous) -> packed texture storage */
+using save_kernel = void (*)(const void *src, std::ptrdiff_t row_stride, std::ptrdiff_t texel_stride, void *dst, size_t height, size_t width);
+
+/* Interleaved NumPy elements (after any widening) -> resampled interleaved NumPy elements */
+using resize_kernel = void (*)(const void *src, size_t src_w, size_t src_h, void *dst, size_t dst_w, size_t dst_h, resize_filter filter, size_t num_threads);
+
+/* As load_kernel, also gathering per-channel statistics. `dst` may be null to only gather them */
+using stats_kernel = void (*)(const void *src, void *dst, size_t pixels, bool planar, texture_stats &stats);
+
+
+struct format_traits {
+    gli::format format;
+    const char *dtype;      // NumPy buffer format of one output element
+    size_t itemsize;        // bytes per output element
+    size_t channels;        // elements per texel
+    bool half;              // stored as IEEE half, widened to float32 on load
+    bool bgr;               // stored B, G, R(, A), presented to NumPy as R, G, B(, A)
+    size_t texel_size;      // bytes per stored texel
+    load_kernel load;
+    save_kernel save;
+    resize_kernel resize;
+    stats_kernel load_stats;    // from texture storage
+    stats_kernel stats;         // from interleaved NumPy elements, e.g. a resampled image
+
+    /* NumPy elements are the stored texels bit for bit, so storage can be viewed or copied as is */
+    constexpr bool as_stored() const { return !half && !bgr; }
+};
+
+
+namespace detail {
+
+template <typename T> constexpr const char *buffer_format();
+template <> constexpr const char *buffer_format<std::uint8_t>() { return "B"; }
+template <> constexpr const char *buffer_format<std::int8_t>() { return "b"; }
+template <> constexpr const char *buffer_format<std::uint16_t>() { return "H"; }
+template <> constexpr const char *buffer_format<std::int16_t>() { return "h"; }
+template <> constexpr const char *buffer_format<std::uint32_t>() { return "I"; }
+template <> constexpr const char *buffer_format<std::int32_t>() { return "i"; }
+template <> constexpr const char *buffer_format<std::uint64_t>() { return "Q"; }
+template <> constexpr const char *buffer_format<std::int64_t>() { return "q"; }
+template <> constexpr const char *buffer_format<float>() { return "f"; }
+template <> constexpr const char *buffer_format<double>() { return "d"; }
+
+
+template <typename T, size_t C>
+void load_texels(const void *src, void *dst, size_t pixels, bool planar) {
+    if constexpr (C > 1) {
+        if (planar) {
+            deinterleave_n<C>(static_cast<const T *>(src), static_cast<T *>(dst), pixels, [](T v) { return v; });
+            return;
+        }
+    }
+    std::memcpy(dst, src, pixels * C * sizeof(T));
+}
+
+
+template <size_t C>
+void load_half_texels(const void *src, void *dst, size_t pixels, bool planar) {
+    const auto *in = static_cast<const std::uint16_t *>(src);
+    if constexpr (C > 1) {
+        if (planar) {
+            deinterleave_n<C>(in, static_cast<float *>(dst), pixels, [](std::uint16_t h) { return half_to_float(h); });
+            return;
+        }
+    }
+    half_to_float(in, static_cast<float *>(dst), pixels * C);
+}
+
+
+template <typename T, size_t C>
+void load_bgr_texels(const void *src, void *dst, size_t pixels, bool planar) {
+    const auto *in = static_cast<const T *>(src);
+    auto *out = static_cast<T *>(dst);
+    const size_t step = planar ? 1 : C;
+    for (size_t p0 = 0; p0 < pixels; p0 += TRANSPOSE_BLOCK) {
+        const size_t n = std::min(TRANSPOSE_BLOCK, pixels - p0);
+        const T *block = in + p0 * C;
+        for (size_t c = 0; c < C; c++) {
+            T *channel = planar ? out + c * pixels + p0 : out + p0 * C + c;
+            for (size_t p = 0; p < n; p++)
+                channel[p * step] = block[p * C + bgr_channel(c)];
+        }
+    }
+}
+
+
+/* Only the texel size matters when packing, so formats of equal size share one instantiation */
+template <size_t TexelSize>
+void save_texels(const void *src, std::ptrdiff_t row_stride, std::ptrdiff_t texel_stride, void *dst, size_t height, size_t width) {
+    const auto *in = static_cast<const std::uint8_t *>(src);
+    auto *out = static_cast<std::uint8_t *>(dst);
+    for (size_t y = 0; y < height; y++, out += width * TexelSize) {
+        const std::uint8_t *row = in + std::ptrdiff_t(y) * row_stride;
+        if (texel_stride == std::ptrdiff_t(TexelSize)) {
+            std::memcpy(out, row, width * TexelSize);
+            continue;
+        }
+        for (size_t x = 0; x < width; x++)
+            std::memcpy(out + x * TexelSize, row + std::ptrdiff_t(x) * texel_stride, TexelSize);
+    }
+}
+
+
+/* R, G, B(, A) NumPy texels -> B, G, R(, A) storage */
+template <typename T, size_t C>
+void save_bgr_texels(const void *src, std::ptrdiff_t row_stride, std::ptrdiff_t texel_stride, void *dst, size_t height, size_t width) {
+    const auto *in = static_cast<const std::uint8_t *>(src);
+    auto *out = static_cast<T *>(dst);
+    for (size_t y = 0; y < height; y++) {
+        const std::uint8_t *row = in + std::ptrdiff_t(y) * row_stride;
+        for (size_t x = 0; x < width; x++, out += C) {
+            const std::uint8_t *texel = row + std::ptrdiff_t(x) * texel_stride;
+            for (size_t c = 0; c < C; c++)
+                std::memcpy(out + c, texel + bgr_channel(c) * sizeof(T), sizeof(T));
+        }
+    }
+}
+
+
+template <typename T, size_t C>
+constexpr format_traits texel(gli::format format) {
+    return {format, buffer_format<T>(), sizeof(T), C, false, false, sizeof(T) * C, &load_texels<T, C>, &save_texels<sizeof(T) * C>,
+            &resize_texels<T, C>, &load_stats_texels<T, T, C>, &load_stats_texels<T, T, C>};
+}
+
+
+/* Stored with red and blue swapped, presented to NumPy in RGB(A) order both ways */
+template <typename T, size_t C>
+constexpr format_traits bgr_texel(gli::format format) {
+    return {format, buffer_format<T>(), sizeof(T), C, false, true, sizeof(T) * C, &load_bgr_texels<T, C>, &save_bgr_texels<T, C>,
+            &resize_texels<T, C>, &load_stats_texels<T, T, C, true>, &load_stats_texels<T, T, C>};
+}
+
+
+/* Saved from raw half bits (float16 / uint16 arrays), widened to float32 on load */
+template <size_t C>
+constexpr format_traits half_texel(gli::format format) {
+    return {format, buffer_format<float>(), sizeof(float), C, true, false, sizeof(std::uint16_t) * C, &load_half_texels<C>,
+            &save_texels<sizeof(std::uint16_t) * C>, &resize_texels<float, C>, &load_stats_texels<std::uint16_t, float, C>,
+            &load_stats_texels<float, float, C>};
+}
+
+} // namespace detail
+
+
+inline constexpr format_traits FORMAT_TABLE[] = {
+    detail::texel<std::uint8_t, 1>(gli::FORMAT_R8_UNORM_PACK8),
+    detail::texel<std::int8_t, 1>(gli::FORMAT_R8_SNORM_PACK8),
+    detail::texel<std::uint8_t, 1>(gli::FORMAT_R8_USCALED_PACK8),
+    detail::texel<std::int8_t, 1>(gli::FORMAT_R8_SSCALED_PACK8),
+    detail::texel<std::uint8_t, 1>(gli::FORMAT_R8_UINT_PACK8),
+    detail::texel<std::int8_t, 1>(gli::FORMAT_R8_SINT_PACK8),
+    detail::texel<std::uint8_t, 1>(gli::FORMAT_R8_SRGB_PACK8),
+
+    detail::texel<std::uint8_t, 2>(gli::FORMAT_RG8_UNORM_PACK8),
+    detail::texel<std::int8_t, 2>(gli::FORMAT_RG8_SNORM_PACK8),
+    detail::texel<std::uint8_t, 2>(gli::FORMAT_RG8_USCALED_PACK8),
+    detail::texel<std::int8_t, 2>(gli::FORMAT_RG8_SSCALED_PACK8),
+    detail::texel<std::uint8_t, 2>(gli::FORMAT_RG8_UINT_PACK8),
+    detail::texel<std::int8_t, 2>(gli::FORMAT_RG8_SINT_PACK8),
+    detail::texel<std::uint8_t, 2>(gli::FORMAT_RG8_SRGB_PACK8),
+
+    detail::texel<std::uint8_t, 3>(gli::FORMAT_RGB8_UNORM_PACK8),
+    detail::texel<std::int8_t, 3>(gli::FORMAT_RGB8_SNORM_PACK8),
+    detail::texel<std::uint8_t, 3>(gli::FORMAT_RGB8_USCALED_PACK8),
+    detail::texel<std::int8_t, 3>(gli::FORMAT_RGB8_SSCALED_PACK8),
+    detail::texel<std::uint8_t, 3>(gli::FORMAT_RGB8_UINT_PACK8),
+    detail::texel<std::int8_t, 3>(gli::FORMAT_RGB8_SINT_PACK8),
+    detail::texel<std::uint8_t, 3>(gli::FORMAT_RGB8_SRGB_PACK8),
+
+    detail::bgr_texel<std::uint8_t, 3>(gli::FORMAT_BGR8_UNORM_PACK8),
+    detail::bgr_texel<std::int8_t, 3>(gli::FORMAT_BGR8_SNORM_PACK8),
+    detail::bgr_texel<std::uint8_t, 3>(gli::FORMAT_BGR8_USCALED_PACK8),
+    detail::bgr_texel<std::int8_t, 3>(gli::FORMAT_BGR8_SSCALED_PACK8),
+    detail::bgr_texel<std::uint8_t, 3>(gli::FORMAT_BGR8_UINT_PACK8),
+    detail::bgr_texel<std::int8_t, 3>(gli::FORMAT_BGR8_SINT_PACK8),
+    detail::bgr_texel<std::uint8_t, 3>(gli::FORMAT_BGR8_SRGB_PACK8),
+
+    detail::texel<std::uint8_t, 4>(gli::FORMAT_RGBA8_UNORM_PACK8),
+    detail::texel<std::int8_t, 4>(gli::FORMAT_RGBA8_SNORM_PACK8),
+    detail::texel<std::uint8_t, 4>(gli::FORMAT_RGBA8_USCALED_PACK8),
+    detail::texel<std::int8_t, 4>(gli::FORMAT_RGBA8_SSCALED_PACK8),
+    detail::texel<std::uint8_t, 4>(gli::FORMAT_RGBA8_UINT_PACK8),
+    detail::texel<std::int8_t, 4>(gli::FORMAT_RGBA8_SINT_PACK8),
+    detail::texel<std::uint8_t, 4>(gli::FORMAT_RGBA8_SRGB_PACK8),
+
+    detail::bgr_texel<std::uint8_t, 4>(gli::FORMAT_BGRA8_UNORM_PACK8),
+    detail::bgr_texel<std::int8_t, 4>(gli::FORMAT_BGRA8_SNORM_PACK8),
+    detail::bgr_texel<std::uint8_t, 4>(gli::FORMAT_BGRA8_USCALED_PACK8),
+    detail::bgr_texel<std::int8_t, 4>(gli::FORMAT_BGRA8_SSCALED_PACK8),
+    detail::bgr_texel<std::uint8_t, 4>(gli::FORMAT_BGRA8_UINT_PACK8),
+    detail::bgr_texel<std::int8_t, 4>(gli::FORMAT_BGRA8_SINT_PACK8),
+    detail::bgr_texel<std::uint8_t, 4>(gli::FORMAT_BGRA8_SRGB_PACK8),
+
+    detail::texel<std::uint8_t, 4>(gli::FORMAT_RGBA8_UNORM_PACK32),
+    detail::texel<std::int8_t, 4>(gli::FORMAT_RGBA8_SNORM_PACK32),
+    detail::texel<std::uint8_t, 4>(gli::FORMAT_RGBA8_USCALED_PACK32),
+    detail::texel<std::int8_t, 4>(gli::FORMAT_RGBA8_SSCALED_PACK32),
+    detail::texel<std::uint8_t, 4>(gli::FORMAT_RGBA8_UINT_PACK32),
+    detail::texel<std::int8_t, 4>(gli::FORMAT_RGBA8_SINT_PACK32),
+    detail::texel<std::uint8_t, 4>(gli::FORMAT_RGBA8_SRGB_PACK32),
+
+    detail::texel<std::uint16_t, 1>(gli::FORMAT_R16_UNORM_PACK16),
+    detail::texel<std::int16_t, 1>(gli::FORMAT_R16_SNORM_PACK16),
+    detail::texel<std::uint16_t, 1>(gli::FORMAT_R16_USCALED_PACK16),
+    detail::texel<std::int16_t, 1>(gli::FORMAT_R16_SSCALED_PACK16),
+    detail::texel<std::uint16_t, 1>(gli::FORMAT_R16_UINT_PACK16),
+    detail::texel<std::int16_t, 1>(gli::FORMAT_R16_SINT_PACK16),
+    detail::half_texel<1>(gli::FORMAT_R16_SFLOAT_PACK16),
+
+    detail::texel<std::uint16_t, 2>(gli::FORMAT_RG16_UNORM_PACK16),
+    detail::texel<std::int16_t, 2>(gli::FORMAT_RG16_SNORM_PACK16),
+    detail::texel<std::uint16_t, 2>(gli::FORMAT_RG16_USCALED_PACK16),
+    detail::texel<std::int16_t, 2>(gli::FORMAT_RG16_SSCALED_PACK16),
+    detail::texel<std::uint16_t, 2>(gli::FORMAT_RG16_UINT_PACK16),
+    detail::texel<std::int16_t, 2>(gli::FORMAT_RG16_SINT_PACK16),
+    detail::half_texel<2>(gli::FORMAT_RG16_SFLOAT_PACK16),
+
+    detail::texel<std::uint16_t, 3>(gli::FORMAT_RGB16_UNORM_PACK16),
+    detail::texel<std::int16_t, 3>(gli::FORMAT_RGB16_SNORM_PACK16),
+    detail::texel<std::uint16_t, 3>(gli::FORMAT_RGB16_USCALED_PACK16),
+    detail::texel<std::int16_t, 3>(gli::FORMAT_RGB16_SSCALED_PACK16),
+    detail::texel<std::uint16_t, 3>(gli::FORMAT_RGB16_UINT_PACK16),
+    detail::texel<std::int16_t, 3>(gli::FORMAT_RGB16_SINT_PACK16),
+    detail::half_texel<3>(gli::FORMAT_RGB16_SFLOAT_PACK16),
+
+    detail::texel<std::uint16_t, 4>(gli::FORMAT_RGBA16_UNORM_PACK16),
+    detail::texel<std::int16_t, 4>(gli::FORMAT_RGBA16_SNORM_PACK16),
+    detail::texel<std::uint16_t, 4>(gli::FORMAT_RGBA16_USCALED_PACK16),
+    detail::texel<std::int16_t, 4>(gli::FORMAT_RGBA16_SSCALED_PACK16),
+    detail::texel<std::uint16_t, 4>(gli::FORMAT_RGBA16_UINT_PACK16),
+    detail::texel<std::int16_t, 4>(gli::FORMAT_RGBA16_SINT_PACK16),
+    detail::half_texel<4>(gli::FORMAT_RGBA16_SFLOAT_PACK16),
+
+    detail::texel<std::uint32_t, 1>(gli::FORMAT_R32_UINT_PACK32),
+    detail::texel<std::int32_t, 1>(gli::FORMAT_R32_SINT_PACK32),
+    detail::texel<float, 1>(gli::FORMAT_R32_SFLOAT_PACK32),
+
+    detail::texel<std::uint32_t, 2>(gli::FORMAT_RG32_UINT_PACK32),
+    detail::texel<std::int32_t, 2>(gli::FORMAT_RG32_SINT_PACK32),
+    detail::texel<float, 2>(gli::FORMAT_RG32_SFLOAT_PACK32),
+
+    detail::texel<std::uint32_t, 3>(gli::FORMAT_RGB32_UINT_PACK32),
+    detail::texel<std::int32_t, 3>(gli::FORMAT_RGB32_SINT_PACK32),
+    detail::texel<float, 3>(gli::FORMAT_RGB32_SFLOAT_PACK32),
+
+    detail::texel<std::uint32_t, 4>(gli::FORMAT_RGBA32_UINT_PACK32),
+    detail::texel<std::int32_t, 4>(gli::FORMAT_RGBA32_SINT_PACK32),
+    detail::texel<float, 4>(gli::FORMAT_RGBA32_SFLOAT_PACK32),
+
+    detail::texel<std::uint64_t, 1>(gli::FORMAT_R64_UINT_PACK64),
+    detail::texel<std::int64_t, 1>(gli::FORMAT_R64_SINT_PACK64),
+    detail::texel<double, 1>(gli::FORMAT_R64_SFLOAT_PACK64),
+
+    detail::texel<std::uint64_t, 2>(gli::FORMAT_RG64_UINT_PACK64),
+    detail::texel<std::int64_t, 2>(gli::FORMAT_RG64_SINT_PACK64),
+    detail::texel<double, 2>(gli::FORMAT_RG64_SFLOAT_PACK64),
+
+    detail::texel<std::uint64_t, 3>(gli::FORMAT_RGB64_UINT_PACK64),
+    detail::texel<std::int64_t, 3>(gli::FORMAT_RGB64_SINT_PACK64),
+    detail::texel<double, 3>(gli::FORMAT_RGB64_SFLOAT_PACK64),
+
+    detail::texel<std::uint64_t, 4>(gli::FORMAT_RGBA64_UINT_PACK64),
+    detail::texel<std::int64_t, 4>(gli::FORMAT_RGBA64_SINT_PACK64),
+    detail::texel<double, 4>(gli::FORMAT_RGBA64_SFLOAT_PACK64),
+
+    detail::texel<std::uint16_t, 1>(gli::FORMAT_D16_UNORM_PACK16),
+    detail::texel<std::uint32_t, 1>(gli::FORMAT_D24_UNORM_PACK32),     // depth in the low 24 bits
+    detail::texel<float, 1>(gli::FORMAT_D32_SFLOAT_PACK32),
+    detail::texel<std::uint8_t, 1>(gli::FORMAT_S8_UINT_PACK8),
+};
+
+
+namespace detail {
+
+constexpr size_t FORMAT_TABLE_SIZE = sizeof(FORMAT_TABLE) / sizeof(FORMAT_TABLE[0]);
+
+/* gli::format -> FORMAT_TABLE row, -1 for formats without an entry */
+constexpr std::array<std::int16_t, gli::FORMAT_LAST + 1> make_format_index() {
+    std::array<std::int16_t, gli::FORMAT_LAST + 1> index{};
+    for (size_t f = 0; f < index.size(); f++)
+        index[f] = -1;
+    for (size_t i = 0; i < FORMAT_TABLE_SIZE; i++)
+        index[FORMAT_TABLE[i].format] = std::int16_t(i);
+    return index;
+}
+
+constexpr bool formats_unique() {
+    for (size_t i = 0; i < FORMAT_TABLE_SIZE; i++)
+        for (size_t j = i + 1; j < FORMAT_TABLE_SIZE; j++)
+            if (FORMAT_TABLE[i].format == FORMAT_TABLE[j].format)
+                return false;
+    return true;
+}
+
+inline constexpr auto FORMAT_INDEX = make_format_index();
+
+static_assert(formats_unique(), "FORMAT_TABLE lists a format twice");
+
+} // namespace detail
+
+
+/*
+ * nullptr when pygli can't move the format to / from NumPy: compressed formats, and formats
+ * packing channels of different widths or types into one word (RGB565, RGB10A2, RG11B10,
+ * RGB9E5, combined depth / stencil, ...), which no single NumPy element type describes.
+ */
+inline const format_traits *find_format_traits(gli::format format) {
+    if (format < 0 || format > gli::FORMAT_LAST)
+        return nullptr;
+    const std::int16_t i = detail::FORMAT_INDEX[format];
+    return i < 0 ? nullptr : &FORMAT_TABLE[i];
+}
@@ -0,0 +1,379 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+
+#include <zstd.h>
+#include <gli/gli.hpp>
+
+#include "buffer_pool.hpp"
+#include "parallel.hpp"
+
+
+/*
+ * Minimal KTX2 container support, uncompressed or with Zstandard level supercompression.
+ * https://registry.khronos.org/KTX/specs/2.0/ktxspec.v2.html
+ *
+ * gli's format enum shares its numbering with VkFormat up to the ASTC formats, so the
+ * vkFormat field maps straight onto gli::format for everything gli can represent.
+ */
+namespace ktx2 {
+
+constexpr std::uint8_t IDENTIFIER[12] = {0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A};
+constexpr std::uint32_t SUPERCOMPRESSION_NONE = 0;
+constexpr std::uint32_t SUPERCOMPRESSION_ZSTD = 2;
+
+struct header {
+    std::uint8_t identifier[12];
+    std::uint32_t vk_format;
+    std::uint32_t type_size;
+    std::uint32_t width;
+    std::uint32_t height;
+    std::uint32_t depth;
+    std::uint32_t layers;
+    std::uint32_t faces;
+    std::uint32_t levels;
+    std::uint32_t supercompression;
+    std::uint32_t dfd_offset;
+    std::uint32_t dfd_length;
+    std::uint32_t kvd_offset;
+    std::uint32_t kvd_length;
+    std::uint64_t sgd_offset;
+    std::uint64_t sgd_length;
+};
+static_assert(sizeof(header) == 80, "KTX2 header must be packed");
+
+struct level_index {
+    std::uint64_t offset;
+    std::uint64_t length;
+    std::uint64_t uncompressed_length;
+};
+static_assert(sizeof(level_index) == 24, "KTX2 level index must be packed");
+
+
+inline bool vk_compatible(gli::format format) {
+    return format >= gli::FORMAT_FIRST && format <= gli::FORMAT_RGBA_ASTC_12X12_SRGB_BLOCK16;
+}
+
+
+inline bool is_ktx2(const std::uint8_t *data, size_t size) {
+    return size >= sizeof(IDENTIFIER) && std::memcmp(data, IDENTIFIER, sizeof(IDENTIFIER)) == 0;
+}
+
+
+inline bool is_ktx2(const std::string &filepath) {
+    std::uint8_t identifier[sizeof(IDENTIFIER)];
+    std::ifstream file(filepath, std::ios::binary);
+    return file.read(reinterpret_cast<char *>(identifier), sizeof(identifier)) && is_ktx2(identifier, sizeof(identifier));
+}
+
+
+inline gli::target target_of(const header &h) {
+    const bool array = h.layers > 0;
+    if (h.faces == 6)
+        return array ? gli::TARGET_CUBE_ARRAY : gli::TARGET_CUBE;
+    if (h.depth > 0)
+        return gli::TARGET_3D;
+    if (h.height == 0)
+        return array ? gli::TARGET_1D_ARRAY : gli::TARGET_1D;
+    return array ? gli::TARGET_2D_ARRAY : gli::TARGET_2D;
+}
+
+
+namespace detail {
+
+struct zstd_dctx_deleter {
+    void operator()(ZSTD_DCtx *ctx) const { ZSTD_freeDCtx(ctx); }
+};
+
+inline size_t lcm(size_t a, size_t b) {
+    size_t x = a, y = b;
+    while (y != 0) {
+        const size_t t = x % y;
+        x = y;
+        y = t;
+    }
+    return a / x * b;
+}
+
+inline void put_u32(std::vector<std::uint8_t> &out, std::uint32_t v) {
+    const auto *bytes = reinterpret_cast<const std::uint8_t *>(&v);
+    out.insert(out.end(), bytes, bytes + sizeof(v));
+}
+
+/*
+ * Basic data format descriptor for formats stored as an array of equally sized components.
+ * Packed and block compressed formats need hand written descriptors and are not written.
+ * Supercompressed files are "unsized", so leave bytesPlane0 as zero.
+ */
+inline std::vector<std::uint8_t> build_dfd(gli::format format, bool sized) {
+    const size_t channels = gli::component_count(format);
+    const size_t block_size = gli::block_size(format);
+    if (gli::is_compressed(format) || channels == 0 || channels > 4 || (block_size % channels) != 0)
+        throw std::invalid_argument("Format can't be written to KTX2");
+    const size_t bits = block_size * 8 / channels;
+    if (bits != 8 && bits != 16 && bits != 32 && bits != 64)
+        throw std::invalid_argument("Format can't be written to KTX2");
+
+    const bool bgr = (format >= gli::FORMAT_BGR8_UNORM_PACK8 && format <= gli::FORMAT_BGR8_SRGB_PACK8)
+                  || (format >= gli::FORMAT_BGRA8_UNORM_PACK8 && format <= gli::FORMAT_BGRA8_SRGB_PACK8);
+    const bool is_float = gli::is_float(format);
+    const bool is_signed = gli::is_signed(format);
+    const bool normalized = gli::is_normalized(format);
+    const bool srgb = gli::is_srgb(format);
+
+    // KHR_DF channel ids and sample qualifiers
+    const std::uint32_t rgba[4] = {0, 1, 2, 15};
+    const std::uint32_t bgra[4] = {2, 1, 0, 15};
+    const std::uint32_t QUALIFIER_LINEAR = 0x10, QUALIFIER_SIGNED = 0x40, QUALIFIER_FLOAT = 0x80;
+
+    const std::uint32_t block_bytes = 24 + 16 * std::uint32_t(channels);
+    std::vector<std::uint8_t> dfd;
+    put_u32(dfd, 4 + block_bytes);                              // dfdTotalSize
+    put_u32(dfd, 0);                                            // vendorId / descriptorType: Khronos basic
+    put_u32(dfd, 2 | (block_bytes << 16));                      // versionNumber / descriptorBlockSize
+    put_u32(dfd, 1 | (1 << 8) | ((srgb ? 2u : 1u) << 16));      // RGBSDA model, BT709 primaries, transfer
+    put_u32(dfd, 0);                                            // 1x1x1x1 texel block
+    put_u32(dfd, sized ? std::uint32_t(block_size) : 0u);       // bytesPlane0
+    put_u32(dfd, 0);
+
+    for (size_t c = 0; c < channels; c++) {
+        const bool alpha = c == 3;
+        std::uint32_t qualifiers = 0;
+        if (is_float) qualifiers |= QUALIFIER_FLOAT;
+        if (is_signed) qualifiers |= QUALIFIER_SIGNED;
+        if (srgb && alpha) qualifiers |= QUALIFIER_LINEAR;
+
+        std::uint32_t lower = 0, upper = 1;
+        if (is_float) {
+            lower = is_signed ? 0xBF800000u : 0u;               // -1.0f / 0.0f
+            upper = 0x3F800000u;                                // 1.0f
+        } else if (normalized) {
+            const std::uint64_t max = is_signed ? (1ull << (bits - 1)) - 1 : (bits >= 32 ? 0xFFFFFFFFull : (1ull << bits) - 1);
+            upper = std::uint32_t(std::min<std::uint64_t>(max, 0xFFFFFFFFull));
+            lower = is_signed ? std::uint32_t(-std::int64_t(upper)) : 0u;
+        }
+
+        const std::uint32_t channel = bgr ? bgra[c] : rgba[c];
+        put_u32(dfd, std::uint32_t(c * bits) | (std::uint32_t(bits - 1) << 16) | ((channel | qualifiers) << 24));
+        put_u32(dfd, 0);                                        // samplePosition
+        put_u32(dfd, lower);
+        put_u32(dfd, upper);
+    }
+    return dfd;
+}
+
+} // namespace detail
+
+
+/* Parsed KTX2 file held in memory, level data is decoded on demand */
+class reader {
+public:
+    explicit reader(const std::string &filepath) {
+        std::ifstream file(filepath, std::ios::binary | std::ios::ate);
+        if (!file.good())
+            throw std::invalid_argument("File doesn't exist: " + filepath);
+        file_ = pool::acquire(size_t(file.tellg()));
+        file.seekg(0);
+        if (!file.read(file_.chars(), file_.size()))
+            throw std::runtime_error("Failed to read: " + filepath);
+        data_ = file_.chars();
+        size_ = file_.size();
+        parse(filepath);
+    }
+
+    reader(std::vector<char> &&data, const std::string &name) : owned_(std::move(data)) {
+        data_ = owned_.data();
+        size_ = owned_.size();
+        parse(name);
+    }
+
+    const header &info() const { return header_; }
+    gli::format format() const { return static_cast<gli::format>(header_.vk_format); }
+    gli::target target() const { return target_of(header_); }
+    gli::extent3d extent() const {
+        return gli::extent3d(header_.width, std::max<std::uint32_t>(header_.height, 1), std::max<std::uint32_t>(header_.depth, 1));
+    }
+    size_t layers() const { return std::max<std::uint32_t>(header_.layers, 1); }
+    size_t faces() const { return header_.faces; }
+    size_t levels() const { return levels_.size(); }
+    size_t level_size(size_t level) const { return size_t(levels_[level].uncompressed_length); }
+
+    /*
+     * Decodes the start of a level (laid out layer, face, z) into `dst`. Only the first
+     * `bytes` bytes are produced, so the first image of a level costs only its own size.
+     */
+    void read_level(size_t level, void *dst, size_t bytes) const {
+        const level_index &index = levels_.at(level);
+        const char *src = data_ + index.offset;
+        bytes = std::min<size_t>(bytes, size_t(index.uncompressed_length));
+
+        if (header_.supercompression == SUPERCOMPRESSION_NONE) {
+            if (index.length < bytes)
+                throw std::runtime_error("Truncated KTX2 level data");
+            std::memcpy(dst, src, bytes);
+            return;
+        }
+
+        std::unique_ptr<ZSTD_DCtx, detail::zstd_dctx_deleter> ctx(ZSTD_createDCtx());
+        ZSTD_inBuffer in = {src, size_t(index.length), 0};
+        ZSTD_outBuffer out = {dst, bytes, 0};
+        while (out.pos < out.size) {
+            const size_t in_pos = in.pos, out_pos = out.pos;
+            const size_t ret = ZSTD_decompressStream(ctx.get(), &out, &in);
+            if (ZSTD_isError(ret))
+                throw std::runtime_error(std::string("Zstd decompression failed: ") + ZSTD_getErrorName(ret));
+            if ((ret == 0 && out.pos < out.size) || (in.pos == in_pos && out.pos == out_pos))
+                throw std::runtime_error("Truncated KTX2 level data");
+        }
+    }
+
+    /* Decodes every level into a gli texture, levels are decompressed in parallel */
+    gli::texture texture(size_t num_threads) const {
+        gli::texture tex(target(), format(), extent(), layers(), faces(), levels());
+        parallel_for(levels(), num_threads, [&](size_t level) {
+            const size_t image_size = tex.size(level);
+            const size_t images = layers() * faces();
+            if (level_size(level) != image_size * images)
+                throw std::runtime_error("KTX2 level size doesn't match its format and extent");
+
+            // gli stores each layer / face contiguously across levels, so only single images decode in place
+            if (images == 1) {
+                read_level(level, tex.data(0, 0, level), image_size);
+                return;
+            }
+            pool::buffer scratch = pool::acquire(level_size(level));
+            read_level(level, scratch.data(), scratch.size());
+            for (size_t layer = 0; layer < layers(); layer++) {
+                for (size_t face = 0; face < faces(); face++) {
+                    const size_t image = layer * faces() + face;
+                    std::memcpy(tex.data(layer, face, level), scratch.data() + image * image_size, image_size);
+                }
+            }
+        });
+        return tex;
+    }
+
+private:
+    void parse(const std::string &filepath) {
+        if (size_ < sizeof(header) || !is_ktx2(reinterpret_cast<const std::uint8_t *>(data_), size_))
+            throw std::invalid_argument("Not a KTX2 file: " + filepath);
+        std::memcpy(&header_, data_, sizeof(header));
+
+        if (!vk_compatible(format()))
+            throw std::invalid_argument("Unrecognised KTX2 Format: " + std::to_string(header_.vk_format));
+        if (header_.supercompression != SUPERCOMPRESSION_NONE && header_.supercompression != SUPERCOMPRESSION_ZSTD)
+            throw std::invalid_argument("Unsupported KTX2 supercompression scheme: " + std::to_string(header_.supercompression));
+        if (header_.faces != 1 && header_.faces != 6)
+            throw std::invalid_argument("Invalid KTX2 face count");
+
+        const size_t count = std::max<std::uint32_t>(header_.levels, 1);
+        if (sizeof(header) + count * sizeof(level_index) > size_)
+            throw std::runtime_error("Truncated KTX2 level index");
+        levels_.resize(count);
+        std::memcpy(levels_.data(), data_ + sizeof(header), count * sizeof(level_index));
+        for (const auto &index : levels_) {
+            if (index.offset > size_ || index.length > size_ - index.offset)
+                throw std::runtime_error("Truncated KTX2 level data");
+        }
+    }
+
+    // File bytes, read into a pooled buffer or handed over by the caller
+    pool::buffer file_;
+    std::vector<char> owned_;
+    const char *data_ = nullptr;
+    size_t size_ = 0;
+    header header_;
+    std::vector<level_index> levels_;
+};
+
+
+/*
+ * Serialises a gli texture as KTX2. With zstd_level > 0 every level is Zstandard compressed,
+ * levels are compressed in parallel and stored smallest first as the spec requires.
+ */
+inline std::vector<char> encode(const gli::texture &tex, int zstd_level, size_t num_threads) {
+    const gli::format format = tex.format();
+    if (!vk_compatible(format))
+        throw std::invalid_argument("Format can't be written to KTX2");
+    const bool supercompress = zstd_level > 0;
+    const std::vector<std::uint8_t> dfd = detail::build_dfd(format, !supercompress);
+
+    const gli::target target = tex.target();
+    const gli::extent3d extent = tex.extent();
+    const size_t levels = tex.levels();
+    const size_t images = tex.layers() * tex.faces();
+
+    // Gather (and compress) each level as layer, face ordered images
+    std::vector<pool::buffer> level_data(levels);
+    std::vector<std::uint64_t> uncompressed(levels);
+    parallel_for(levels, num_threads, [&](size_t level) {
+        const size_t image_size = tex.size(level);
+        pool::buffer raw = pool::acquire(image_size * images);
+        for (size_t layer = 0; layer < tex.layers(); layer++) {
+            for (size_t face = 0; face < tex.faces(); face++) {
+                const size_t image = layer * tex.faces() + face;
+                std::memcpy(raw.data() + image * image_size, tex.data(layer, face, level), image_size);
+            }
+        }
+        uncompressed[level] = raw.size();
+        if (!supercompress) {
+            level_data[level] = std::move(raw);
+            return;
+        }
+        pool::buffer packed = pool::acquire(ZSTD_compressBound(raw.size()));
+        const size_t size = ZSTD_compress(packed.data(), packed.size(), raw.data(), raw.size(), zstd_level);
+        if (ZSTD_isError(size))
+            throw std::runtime_error(std::string("Zstd compression failed: ") + ZSTD_getErrorName(size));
+        packed.truncate(size);
+        level_data[level] = std::move(packed);
+    });
+
+    header h = {};
+    std::memcpy(h.identifier, IDENTIFIER, sizeof(IDENTIFIER));
+    h.vk_format = std::uint32_t(format);
+    h.type_size = std::uint32_t(gli::block_size(format) / gli::component_count(format));
+    h.width = extent.x;
+    h.height = gli::is_target_1d(target) ? 0 : extent.y;
+    h.depth = target == gli::TARGET_3D ? extent.z : 0;
+    h.layers = gli::is_target_array(target) ? std::uint32_t(tex.layers()) : 0;
+    h.faces = std::uint32_t(tex.faces());
+    h.levels = std::uint32_t(levels);
+    h.supercompression = supercompress ? SUPERCOMPRESSION_ZSTD : SUPERCOMPRESSION_NONE;
+    h.dfd_offset = std::uint32_t(sizeof(header) + levels * sizeof(level_index));
+    h.dfd_length = std::uint32_t(dfd.size());
+
+    // Uncompressed levels are aligned to lcm(texel block size, 4), supercompressed ones are not
+    const size_t alignment = supercompress ? 1 : detail::lcm(gli::block_size(format), 4);
+    std::vector<level_index> index(levels);
+    size_t offset = h.dfd_offset + h.dfd_length;
+    for (size_t n = levels; n-- > 0;) {
+        offset = (offset + alignment - 1) / alignment * alignment;
+        index[n] = {offset, level_data[n].size(), uncompressed[n]};
+        offset += level_data[n].size();
+    }
+
+    std::vector<char> out(offset);
+    std::memcpy(out.data(), &h, sizeof(h));
+    std::memcpy(out.data() + sizeof(h), index.data(), index.size() * sizeof(level_index));
+    std::memcpy(out.data() + h.dfd_offset, dfd.data(), dfd.size());
+    for (size_t n = 0; n < levels; n++)
+        std::memcpy(out.data() + index[n].offset, level_data[n].data(), level_data[n].size());
+    return out;
+}
+
+
+inline bool save(const gli::texture &tex, const std::string &filepath, int zstd_level, size_t num_threads) {
+    const std::vector<char> data = encode(tex, zstd_level, num_threads);
+    std::ofstream file(filepath, std::ios::binary | std::ios::trunc);
+    file.write(data.data(), data.size());
+    return file.good();
+}
+
+} // namespace ktx2
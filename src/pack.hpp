@@ -0,0 +1,352 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <gli/gli.hpp>
+
+
+/*
+ * Texture pack archive: many textures concatenated into one file so random access costs a
+ * lookup in an mmapped index rather than an open() per texture.
+ *
+ *   header (64 bytes)
+ *   texture storage, each entry's gli storage (all layers / faces / levels) at an aligned offset
+ *   index, entries sorted by name, followed by the name strings
+ *
+ * Appending writes the new textures and a fresh merged index after the old one, then rewrites
+ * the header last, so an interrupted append leaves the previous pack readable.
+ */
+namespace pack {
+
+constexpr char MAGIC[8] = {'P', 'Y', 'G', 'L', 'I', 'P', 'K', '1'};
+constexpr std::uint32_t VERSION = 1;
+constexpr size_t ALIGNMENT = 64;
+
+struct header {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t count;
+    std::uint64_t index_offset;     // entry[count]
+    std::uint64_t names_offset;     // name bytes referenced by the entries
+    std::uint64_t names_size;
+    std::uint64_t reserved[3];
+};
+
+struct entry {
+    std::uint64_t offset;
+    std::uint64_t size;
+    std::uint64_t name_offset;      // relative to header::names_offset
+    std::uint32_t name_size;
+    std::uint32_t format;
+    std::uint32_t target;
+    std::uint32_t width;
+    std::uint32_t height;
+    std::uint32_t depth;
+    std::uint32_t layers;
+    std::uint32_t faces;
+    std::uint32_t levels;
+    std::uint32_t reserved;
+
+    gli::format tex_format() const { return static_cast<gli::format>(format); }
+    gli::target tex_target() const { return static_cast<gli::target>(target); }
+    gli::extent3d extent() const { return gli::extent3d(width, height, depth); }
+};
+
+static_assert(sizeof(header) == 64, "pack header must be 64 bytes");
+static_assert(sizeof(entry) == 64, "pack entry must be 64 bytes");
+
+
+inline std::uint64_t align(std::uint64_t offset) {
+    return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+}
+
+
+/* Read-only memory mapping of a whole file */
+class mapped_file {
+public:
+    explicit mapped_file(const std::string &filepath) {
+#ifdef _WIN32
+        file_ = CreateFileA(filepath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file_ == INVALID_HANDLE_VALUE)
+            throw std::invalid_argument("File doesn't exist: " + filepath);
+        LARGE_INTEGER size;
+        GetFileSizeEx(file_, &size);
+        size_ = size_t(size.QuadPart);
+        if (size_ > 0) {
+            mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping_)
+                data_ = static_cast<const std::uint8_t *>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+        }
+#else
+        fd_ = ::open(filepath.c_str(), O_RDONLY);
+        if (fd_ < 0)
+            throw std::invalid_argument("File doesn't exist: " + filepath);
+        struct stat st;
+        ::fstat(fd_, &st);
+        size_ = size_t(st.st_size);
+        if (size_ > 0) {
+            void *data = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd_, 0);
+            if (data != MAP_FAILED)
+                data_ = static_cast<const std::uint8_t *>(data);
+        }
+#endif
+        if (!data_) {
+            close();
+            throw std::runtime_error("Failed to map: " + filepath);
+        }
+    }
+
+    ~mapped_file() { close(); }
+
+    mapped_file(const mapped_file &) = delete;
+    mapped_file &operator=(const mapped_file &) = delete;
+
+    const std::uint8_t *data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    void close() {
+#ifdef _WIN32
+        if (data_)
+            UnmapViewOfFile(data_);
+        if (mapping_)
+            CloseHandle(mapping_);
+        if (file_ != INVALID_HANDLE_VALUE)
+            CloseHandle(file_);
+        mapping_ = nullptr;
+        file_ = INVALID_HANDLE_VALUE;
+#else
+        if (data_)
+            ::munmap(const_cast<std::uint8_t *>(data_), size_);
+        if (fd_ >= 0)
+            ::close(fd_);
+        fd_ = -1;
+#endif
+        data_ = nullptr;
+    }
+
+#ifdef _WIN32
+    HANDLE file_ = INVALID_HANDLE_VALUE;
+    HANDLE mapping_ = nullptr;
+#else
+    int fd_ = -1;
+#endif
+    const std::uint8_t *data_ = nullptr;
+    size_t size_ = 0;
+};
+
+
+class reader {
+public:
+    explicit reader(const std::string &filepath) : file_(filepath) {
+        const std::uint8_t *base = file_.data();
+        if (file_.size() < sizeof(header))
+            throw std::invalid_argument("Not a pygli pack: " + filepath);
+        std::memcpy(&header_, base, sizeof(header_));
+        if (std::memcmp(header_.magic, MAGIC, sizeof(MAGIC)) != 0)
+            throw std::invalid_argument("Not a pygli pack: " + filepath);
+        if (header_.version != VERSION)
+            throw std::invalid_argument("Unsupported pack version: " + std::to_string(header_.version));
+        if (header_.index_offset % alignof(entry) != 0
+            || header_.index_offset + std::uint64_t(header_.count) * sizeof(entry) > file_.size()
+            || header_.names_offset + header_.names_size > file_.size())
+            throw std::runtime_error("Truncated pack index: " + filepath);
+
+        entries_ = reinterpret_cast<const entry *>(base + header_.index_offset);
+        names_ = reinterpret_cast<const char *>(base + header_.names_offset);
+        for (size_t i = 0; i < size(); i++) {
+            const entry &e = entries_[i];
+            if (e.offset + e.size > file_.size() || e.name_offset + e.name_size > header_.names_size)
+                throw std::runtime_error("Corrupt pack entry " + std::to_string(i) + ": " + filepath);
+        }
+    }
+
+    size_t size() const { return header_.count; }
+
+    const entry &at(size_t i) const { return entries_[i]; }
+
+    std::string_view name(const entry &e) const {
+        return std::string_view(names_ + e.name_offset, e.name_size);
+    }
+
+    /* Binary search of the sorted index, nullptr when the pack has no such name */
+    const entry *find(std::string_view key) const {
+        const entry *end = entries_ + size();
+        const entry *it = std::lower_bound(entries_, end, key, [this](const entry &e, std::string_view k) { return name(e) < k; });
+        return (it != end && name(*it) == key) ? it : nullptr;
+    }
+
+    std::vector<std::string> keys() const {
+        std::vector<std::string> out;
+        out.reserve(size());
+        for (size_t i = 0; i < size(); i++)
+            out.emplace_back(name(entries_[i]));
+        return out;
+    }
+
+    /* Start of the entry's gli storage inside the mapping */
+    const std::uint8_t *data(const entry &e) const { return file_.data() + e.offset; }
+
+    gli::texture texture(const entry &e) const {
+        gli::texture tex(e.tex_target(), e.tex_format(), e.extent(), e.layers, e.faces, e.levels);
+        if (tex.size() != e.size)
+            throw std::runtime_error("Corrupt pack entry: " + std::string(name(e)));
+        std::memcpy(tex.data(), data(e), e.size);
+        return tex;
+    }
+
+private:
+    mapped_file file_;
+    header header_;
+    const entry *entries_ = nullptr;
+    const char *names_ = nullptr;
+};
+
+
+/*
+ * Appends textures to a pack. add() may be called from several threads, each texture is
+ * written as soon as it arrives; the index is written by close().
+ */
+class writer {
+public:
+    writer(const std::string &filepath, bool append) : filepath_(filepath) {
+        if (append && std::ifstream(filepath).good()) {
+            reader existing(filepath);
+            for (size_t i = 0; i < existing.size(); i++) {
+                const entry &e = existing.at(i);
+                index_.emplace(std::string(existing.name(e)), e);
+            }
+            file_.open(filepath, std::ios::binary | std::ios::in | std::ios::out);
+            file_.seekp(0, std::ios::end);
+            end_ = std::uint64_t(file_.tellp());
+        } else {
+            file_.open(filepath, std::ios::binary | std::ios::out | std::ios::trunc);
+            header h = {};
+            file_.write(reinterpret_cast<const char *>(&h), sizeof(h));
+            end_ = sizeof(h);
+        }
+        if (!file_.good())
+            throw std::runtime_error("Failed to open: " + filepath);
+    }
+
+    ~writer() {
+        try {
+            close();
+        } catch (...) {
+        }
+    }
+
+    writer(const writer &) = delete;
+    writer &operator=(const writer &) = delete;
+
+    /* Adds (or replaces) a texture under `name` */
+    void add(const std::string &name, const gli::texture &tex) {
+        const auto extent = tex.extent();
+        entry e = {};
+        e.size = tex.size();
+        e.format = static_cast<std::uint32_t>(tex.format());
+        e.target = static_cast<std::uint32_t>(tex.target());
+        e.width = extent.x;
+        e.height = extent.y;
+        e.depth = extent.z;
+        e.layers = std::uint32_t(tex.layers());
+        e.faces = std::uint32_t(tex.faces());
+        e.levels = std::uint32_t(tex.levels());
+        write(name, e, tex.data());
+    }
+
+    /* Adds (or replaces) a single 2D image of packed texels under `name`, e.g. a decoded PNG */
+    void add(const std::string &name, gli::format format, size_t width, size_t height, const void *data) {
+        entry e = {};
+        e.size = width * height * gli::block_size(format);
+        e.format = static_cast<std::uint32_t>(format);
+        e.target = static_cast<std::uint32_t>(gli::TARGET_2D);
+        e.width = std::uint32_t(width);
+        e.height = std::uint32_t(height);
+        e.depth = e.layers = e.faces = e.levels = 1;
+        write(name, e, data);
+    }
+
+    /* Writes the sorted index and then the header that points at it */
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!file_.is_open())
+            return;
+
+        std::vector<entry> entries;
+        std::string names;
+        entries.reserve(index_.size());
+        for (const auto &item : index_) {
+            entry e = item.second;
+            e.name_offset = names.size();
+            e.name_size = std::uint32_t(item.first.size());
+            names += item.first;
+            entries.push_back(e);
+        }
+
+        header h = {};
+        std::memcpy(h.magic, MAGIC, sizeof(MAGIC));
+        h.version = VERSION;
+        h.count = std::uint32_t(entries.size());
+        h.index_offset = pad_to(align(end_));
+        h.names_offset = h.index_offset + entries.size() * sizeof(entry);
+        h.names_size = names.size();
+        file_.write(reinterpret_cast<const char *>(entries.data()), entries.size() * sizeof(entry));
+        file_.write(names.data(), names.size());
+        file_.flush();
+        file_.seekp(0);
+        file_.write(reinterpret_cast<const char *>(&h), sizeof(h));
+        file_.close();
+        if (file_.fail())
+            throw std::runtime_error("Failed to write: " + filepath_);
+    }
+
+private:
+    void write(const std::string &name, entry e, const void *data) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        e.offset = pad_to(align(end_));
+        file_.write(static_cast<const char *>(data), e.size);
+        end_ = e.offset + e.size;
+        if (!file_.good())
+            throw std::runtime_error("Failed to write: " + filepath_);
+        index_[name] = e;
+    }
+
+    /* Zero fills from the current end to `offset`, which becomes the write position */
+    std::uint64_t pad_to(std::uint64_t offset) {
+        static const char zeros[ALIGNMENT] = {};
+        file_.seekp(std::streamoff(end_));
+        file_.write(zeros, std::streamsize(offset - end_));
+        end_ = offset;
+        return offset;
+    }
+
+    std::string filepath_;
+    std::fstream file_;
+    std::map<std::string, entry> index_;
+    std::uint64_t end_ = 0;
+    std::mutex mutex_;
+};
+
+} // namespace pack
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <mutex>
+#include <exception>
+#include <algorithm>
+#include <cstddef>
+
+
+inline size_t default_num_threads(size_t num_threads) {
+    if (num_threads > 0)
+        return num_threads;
+    return std::max<size_t>(1, std::thread::hardware_concurrency());
+}
+
+
+/*
+ * Runs f(i) for every i in [0, count) on up to `num_threads` threads (0 = one per core).
+ * Indices are handed out dynamically so uneven items balance out. The first exception
+ * thrown by any call is rethrown on the calling thread once all workers have stopped.
+ */
+template <typename F>
+void parallel_for(size_t count, size_t num_threads, F &&f) {
+    num_threads = std::min(default_num_threads(num_threads), count);
+    if (num_threads <= 1) {
+        for (size_t i = 0; i < count; i++)
+            f(i);
+        return;
+    }
+
+    std::atomic<size_t> next(0);
+    std::exception_ptr error;
+    std::mutex error_mutex;
+
+    auto worker = [&]() {
+        for (size_t i = next++; i < count; i = next++) {
+            try {
+                f(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!error)
+                    error = std::current_exception();
+                next = count;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < num_threads; t++)
+        threads.emplace_back(worker);
+    worker();
+    for (auto &thread : threads)
+        thread.join();
+
+    if (error)
+        std::rethrow_exception(error);
+}
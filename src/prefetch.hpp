@@ -0,0 +1,133 @@
+#pragma once
+
+#include <map>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+#include <exception>
+#include <functional>
+#include <condition_variable>
+
+#include "parallel.hpp"
+
+
+/*
+ * Produces items 0 .. count-1 on background threads ahead of a consumer. At most `prefetch`
+ * items are claimed but not yet taken by next(), so memory stays bounded however far the
+ * consumer falls behind: workers block until it catches up. Items come out in index order,
+ * or in completion order when not `ordered`. An exception thrown producing one item is
+ * handed out as that item's error and the remaining items carry on.
+ */
+template <typename T>
+class prefetch_queue {
+public:
+    struct item {
+        size_t index = 0;
+        T value;
+        std::exception_ptr error;
+    };
+
+    prefetch_queue(size_t count, size_t prefetch, size_t num_threads, bool ordered, std::function<T(size_t)> produce)
+        : count_(count), prefetch_(std::max<size_t>(prefetch, 1)), ordered_(ordered), produce_(std::move(produce)) {
+        num_threads = std::min({default_num_threads(num_threads), prefetch_, std::max<size_t>(count_, 1)});
+        for (size_t t = 0; t < num_threads; t++)
+            workers_.emplace_back([this]() { work(); });
+    }
+
+    ~prefetch_queue() { close(); }
+
+    prefetch_queue(const prefetch_queue &) = delete;
+    prefetch_queue &operator=(const prefetch_queue &) = delete;
+
+    /* Blocks for the next item, false once every item has been taken or the queue was closed */
+    bool next(item &out) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (closed_ || taken_ == count_)
+            return false;
+        ready_.wait(lock, [&]() { return closed_ || (ordered_ ? done_.count(taken_) > 0 : !completed_.empty()); });
+        if (closed_)
+            return false;
+        if (ordered_) {
+            auto it = done_.find(taken_);
+            out = std::move(it->second);
+            done_.erase(it);
+        } else {
+            out = std::move(completed_.front());
+            completed_.pop_front();
+        }
+        taken_++;
+        in_flight_--;
+        lock.unlock();
+        space_.notify_one();
+        return true;
+    }
+
+    /* Stops claiming new items, waits for the ones being produced and drops everything not yet taken */
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+        }
+        space_.notify_all();
+        ready_.notify_all();
+        for (auto &worker : workers_)
+            if (worker.joinable())
+                worker.join();
+        std::lock_guard<std::mutex> lock(mutex_);
+        done_.clear();
+        completed_.clear();
+    }
+
+    size_t size() const { return count_; }
+
+private:
+    void work() {
+        for (;;) {
+            item result;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                space_.wait(lock, [&]() { return closed_ || claimed_ == count_ || in_flight_ < prefetch_; });
+                if (closed_ || claimed_ == count_)
+                    return;
+                result.index = claimed_++;
+                in_flight_++;
+            }
+
+            try {
+                result.value = produce_(result.index);
+            } catch (...) {
+                result.error = std::current_exception();
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (closed_)
+                    continue;
+                if (ordered_)
+                    done_.emplace(result.index, std::move(result));
+                else
+                    completed_.push_back(std::move(result));
+            }
+            ready_.notify_all();
+        }
+    }
+
+    const size_t count_;
+    const size_t prefetch_;
+    const bool ordered_;
+    std::function<T(size_t)> produce_;
+
+    std::mutex mutex_;
+    std::condition_variable space_;     // in_flight_ dropped below prefetch_, or closed
+    std::condition_variable ready_;     // an item finished
+    size_t claimed_ = 0;
+    size_t taken_ = 0;
+    size_t in_flight_ = 0;              // claimed, not yet taken
+    bool closed_ = false;
+    std::map<size_t, item> done_;
+    std::deque<item> completed_;
+    std::vector<std::thread> workers_;
+};
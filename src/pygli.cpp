@@ -1,15 +1,36 @@
 #include <vector>
+#include <string>
 #include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <cctype>
 #include <iostream>
 #include <fstream>
+#include <iterator>
+#include <mutex>
 
 #include <pybind11/pybind11.h>
 #include <pybind11/numpy.h>
+#include <pybind11/stl.h>
 
 #include <gli/gli.hpp>
 #include "gli/type.hpp"
 
-#include "float_convert.hpp"
+#include "atlas.hpp"
+#include "compare.hpp"
+#include "dds_update.hpp"
+#include "dlpack.hpp"
+#include "format_traits.hpp"
+#include "parallel.hpp"
+#include "texture_header.hpp"
+#include "tiles.hpp"
+#include "texture_io.hpp"
+#include "transpose.hpp"
+#include "write_queue.hpp"
+#include "ktx2.hpp"
+#include "pack.hpp"
+#include "prefetch.hpp"
+#include "shared_memory.hpp"
 
 #define STRINGIFY(x) #x
 #define MACRO_STRINGIFY(x) STRINGIFY(x)
@@ -24,822 +45,1370 @@
 namespace py = pybind11;
 
 
-inline bool file_exists (const std::string& name) {
-    std::ifstream f(name.c_str());
-    return f.good();
+/* Traits of a format load() can present to NumPy */
+const format_traits &get_texel_layout(gli::format format) {
+    const format_traits *traits = find_format_traits(format);
+    if (!traits)
+        throw std::invalid_argument("Unrecognised Load Format");
+    return *traits;
 }
 
 
-py::array_t<float> half_to_float(py::array_t<uint16_t> half_arr) {
-      py::buffer_info in = half_arr.request();
+/* Returns true for the planar layouts (CHW / NCHW) and false for interleaved (HWC / NHWC) */
+bool is_planar(const std::string &layout, bool batched) {
+    const std::string prefix = batched ? "N" : "";
+    if (layout == prefix + "HWC")
+        return false;
+    if (layout == prefix + "CHW")
+        return true;
+    throw std::invalid_argument("Unrecognised Layout: " + layout);
+}
 
-      /* No pointer is passed, so NumPy will allocate the buffer */
-      auto out_arr = py::array_t<float>(in.shape);
-      py::buffer_info out = out_arr.request();
 
-      uint16_t *in_ptr = static_cast<uint16_t *>(in.ptr);
-      float *out_ptr = static_cast<float *>(out.ptr);
+/* Output shape of one image, without the batch dimension */
+std::vector<size_t> image_shape(size_t height, size_t width, size_t channels, bool planar) {
+    if (planar)
+        return {channels, height, width};
+    return {height, width, channels};
+}
 
-      size_t length = 1;
-      for (size_t n = 0; n < in.ndim; n++)
-            length *= in.shape[n];
-      
-      for (size_t x = 0; x < length; x++)
-            out_ptr[x] = half_to_float(in_ptr[x]);
-      
-      return out_arr;
+
+/* Python handle of a shared memory output: reattaches the array in any process, and pickles by name */
+struct shared_array {
+    std::shared_ptr<shm::segment> segment;
+    std::string dtype;
+    std::vector<size_t> shape;
+
+    /* A view of the segment that keeps `self` (this handle) alive */
+    py::array array(py::object self) const {
+        return py::array(py::dtype(dtype), shape, segment->data(), self);
+    }
+};
+
+
+/* Allocates an output array, in shared memory (with its shared_array handle as the base) when `shared` */
+py::array allocate(const std::string &dtype, const std::vector<size_t> &shape, bool shared) {
+    if (!shared)
+        return py::array(py::dtype(dtype), shape);
+    size_t bytes = py::dtype(dtype).itemsize();
+    for (size_t n : shape)
+        bytes *= n;
+    auto handle = std::make_shared<shared_array>(shared_array{shm::segment::create(bytes), dtype, shape});
+    return handle->array(py::cast(handle));
+}
+
+
+/* layout.load(), or the fused kernel that also gathers statistics when `stats` is given */
+void load_into(const format_traits &layout, const void *src, void *dst, size_t pixels, bool planar, texture_stats *stats) {
+    if (stats)
+        layout.load_stats(src, dst, pixels, planar, *stats);
+    else
+        layout.load(src, dst, pixels, planar);
+}
+
+
+/* Decompresses only the first image of level 0, straight into the output array when no conversion is needed */
+py::array load_ktx2(const std::string &filepath, bool planar, bool shared, texture_stats *stats) {
+    ktx2::reader reader(filepath);
+    const auto layout = get_texel_layout(reader.format());
+    const auto extent = reader.extent();
+    const size_t pixels = size_t(extent.x) * extent.y;
+    const size_t image_bytes = pixels * gli::block_size(reader.format());
+    std::vector<size_t> shape = image_shape(extent.y, extent.x, layout.channels, planar);
+
+    py::array arr = allocate(layout.dtype, shape, shared);
+    void *dst = arr.mutable_data();
+    {
+        py::gil_scoped_release release;
+        if (layout.as_stored() && !planar) {
+            reader.read_level(0, dst, image_bytes);
+            if (stats)
+                layout.stats(dst, nullptr, pixels, false, *stats);
+        } else {
+            pool::buffer scratch = pool::acquire(image_bytes);
+            reader.read_level(0, scratch.data(), scratch.size());
+            load_into(layout, scratch.data(), dst, pixels, planar, stats);
+        }
+    }
+    return arr;
+}
+
+
+/* Decodes a PNG / TGA / JPEG / HDR image through stb with the GIL released */
+py::array load_image(const std::string &filepath, bool planar, bool shared, texture_stats *stats) {
+    stb::image image;
+    {
+        py::gil_scoped_release release;
+        image = stb::load(filepath);
+    }
+    const auto layout = get_texel_layout(image.format);
+    std::vector<size_t> shape = image_shape(image.height, image.width, layout.channels, planar);
+
+    py::array arr = allocate(layout.dtype, shape, shared);
+    void *dst = arr.mutable_data();
+    {
+        py::gil_scoped_release release;
+        load_into(layout, image.pixels.get(), dst, image.width * image.height, planar, stats);
+    }
+    return arr;
+}
+
+
+py::array load_array(std::string &filepath, bool planar, bool shared, texture_stats *stats) {
+    switch (sniff_container(filepath)) {
+        case container::ktx2:
+            return load_ktx2(filepath, planar, shared, stats);
+        case container::image:
+            return load_image(filepath, planar, shared, stats);
+        default:
+            break;
+    }
+
+    gli::texture tex;
+    {
+        py::gil_scoped_release release;
+        tex = load_texture(filepath, 1);
+    }
+    auto layout = get_texel_layout(tex.format());
+    auto extent = tex.extent();
+    std::vector<size_t> shape = image_shape(extent.y, extent.x, layout.channels, planar);
+
+    py::array arr = allocate(layout.dtype, shape, shared);
+    void *dst = arr.mutable_data();
+    {
+        py::gil_scoped_release release;
+        load_into(layout, tex.data(), dst, size_t(extent.y) * extent.x, planar, stats);
+    }
+    return arr;
+}
+
+
+/* First image of one level of a texture file. Touches no Python state, so callers may release the GIL */
+struct level_image {
+    gli::texture texture;
+    stb::image image;
+    pool::buffer buffer;
+    const void *data = nullptr;
+    gli::format format = gli::FORMAT_UNDEFINED;
+    gli::extent3d extent;
+};
+
+
+/* The smallest stored level covering `width` x `height`, or the base level when both are 0 */
+level_image read_level_image(const std::string &filepath, size_t width, size_t height) {
+    level_image out;
+    const container kind = sniff_container(filepath);
+    if (kind == container::image) {
+        // stb images have no mips, their pixels are used where stb decoded them
+        out.image = stb::load(filepath);
+        out.format = out.image.format;
+        out.extent = gli::extent3d(out.image.width, out.image.height, 1);
+        out.data = out.image.pixels.get();
+    } else if (kind == container::ktx2) {
+        ktx2::reader reader(filepath);
+        const size_t level = width && height ? pick_level(reader.extent(), reader.levels(), width, height) : 0;
+        out.format = reader.format();
+        out.extent = level_extent(reader.extent(), level);
+        out.buffer = pool::acquire(size_t(out.extent.x) * out.extent.y * gli::block_size(out.format));
+        reader.read_level(level, out.buffer.data(), out.buffer.size());
+        out.data = out.buffer.data();
+    } else {
+        out.texture = load_texture(filepath, 1);
+        const size_t level = width && height ? pick_level(out.texture.extent(), out.texture.levels(), width, height) : 0;
+        out.format = out.texture.format();
+        out.extent = out.texture.extent(level);
+        out.data = out.texture.data(0, 0, level);
+    }
+    return out;
 }
 
 
-py::array load(std::string &filepath) {
+/*
+ * Resamples a level image to `width` x `height` NumPy elements at `dst`, gathering statistics
+ * when `stats` is given. Callers already running on a worker (iterate()) pass num_threads = 1.
+ */
+void resample_into(const format_traits &layout, const level_image &image, void *dst, size_t width, size_t height, resize_filter filter,
+                   bool planar, texture_stats *stats, size_t num_threads) {
+    const void *src = image.data;
+    const size_t src_pixels = size_t(image.extent.x) * image.extent.y;
+    const size_t dst_pixels = width * height;
+
+    // Resampling works on interleaved NumPy elements, so half texels are widened and BGR reordered first
+    pool::buffer widened;
+    if (!layout.as_stored()) {
+        widened = pool::acquire(src_pixels * layout.channels * layout.itemsize);
+        layout.load(src, widened.data(), src_pixels, false);
+        src = widened.data();
+    }
+    if (planar && layout.channels > 1) {
+        pool::buffer scratch = pool::acquire(dst_pixels * layout.channels * layout.itemsize);
+        layout.resize(src, image.extent.x, image.extent.y, scratch.data(), width, height, filter, num_threads);
+        if (stats)
+            layout.stats(scratch.data(), dst, dst_pixels, true, *stats);
+        else
+            deinterleave_raw(scratch.data(), dst, dst_pixels, layout.channels, layout.itemsize);
+    } else {
+        layout.resize(src, image.extent.x, image.extent.y, dst, width, height, filter, num_threads);
+        if (stats)
+            layout.stats(dst, nullptr, dst_pixels, false, *stats);
+    }
+}
+
+
+/* load(size=...): decodes only the smallest stored mip covering the target size, then filters it down */
+py::array load_resized(const std::string &filepath, bool planar, bool shared, size_t width, size_t height, resize_filter filter,
+                       texture_stats *stats) {
+    level_image image;
+    {
+        py::gil_scoped_release release;
+        image = read_level_image(filepath, width, height);
+    }
+
+    const auto &layout = get_texel_layout(image.format);
+    py::array arr = allocate(layout.dtype, image_shape(height, width, layout.channels, planar), shared);
+    void *dst = arr.mutable_data();
+    {
+        py::gil_scoped_release release;
+        resample_into(layout, image, dst, width, height, filter, planar, stats, 0);
+    }
+    return arr;
+}
+
+
+/* (width, height) from load()'s size argument, 0 x 0 for None */
+std::pair<size_t, size_t> parse_size(py::object size) {
+    if (size.is_none())
+        return {0, 0};
+    const auto wh = size.cast<std::vector<size_t>>();
+    if (wh.size() != 2 || wh[0] == 0 || wh[1] == 0)
+        throw std::invalid_argument("size must be a (width, height) pair of positive integers");
+    return {wh[0], wh[1]};
+}
+
+
+/* An image decoded without the GIL, handed to NumPy without a copy once a Python thread takes it */
+struct native_image {
+    pool::buffer data;
+    const format_traits *layout = nullptr;
+    std::vector<size_t> shape;
+
+    py::array to_array() {
+        auto *owner = new pool::buffer(std::move(data));
+        py::capsule base(owner, [](void *ptr) { delete static_cast<pool::buffer *>(ptr); });
+        return py::array(py::dtype(layout->dtype), shape, owner->data(), base);
+    }
+};
+
+
+/* As load(filepath, layout, size=(width, height), filter), touching no Python state. 0 x 0 keeps the base size */
+native_image decode_image(const std::string &filepath, bool planar, size_t width, size_t height, resize_filter filter, size_t num_threads) {
+    const level_image image = read_level_image(filepath, width, height);
+    native_image out;
+    out.layout = &get_texel_layout(image.format);
+    const size_t channels = out.layout->channels;
+    const bool resized = width && height;
+    if (!resized) {
+        width = image.extent.x;
+        height = image.extent.y;
+    }
+    out.shape = image_shape(height, width, channels, planar);
+    out.data = pool::acquire(width * height * channels * out.layout->itemsize);
+    if (resized)
+        resample_into(*out.layout, image, out.data.data(), width, height, filter, planar, nullptr, num_threads);
+    else
+        out.layout->load(image.data, out.data.data(), width * height, planar);
+    return out;
+}
+
+
+/* A "dltensor" capsule owning the image's buffer, for torch.from_dlpack() and the like */
+py::capsule to_dlpack(native_image &&image) {
+    dlpack::DLManagedTensor *managed = dlpack::wrap(std::move(image.data), image.shape, dlpack::dtype_of(image.layout->dtype));
+    return py::capsule(managed, "dltensor", [](PyObject *capsule) {
+        // A consumer that took the tensor renamed the capsule to "used_dltensor" and now owns it
+        if (PyCapsule_IsValid(capsule, "dltensor")) {
+            auto *tensor = static_cast<dlpack::DLManagedTensor *>(PyCapsule_GetPointer(capsule, "dltensor"));
+            tensor->deleter(tensor);
+        }
+    });
+}
+
+
+/* A NumPy array over the memory of a CPU "dltensor" capsule, which the array takes ownership of */
+py::array from_dlpack(py::object capsule) {
+    auto *managed = static_cast<dlpack::DLManagedTensor *>(PyCapsule_GetPointer(capsule.ptr(), "dltensor"));
+    if (!managed)
+        throw py::error_already_set();
+    const dlpack::DLTensor &t = managed->dl_tensor;
+    if (t.device.device_type != dlpack::kDLCPU && t.device.device_type != dlpack::kDLCUDAHost)
+        throw std::invalid_argument("Only CPU DLPack tensors can be saved");
+    const py::dtype dtype(dlpack::buffer_format_of(t.dtype));
+
+    // Take ownership before anything else can throw, the owner capsule frees it with the array
+    PyCapsule_SetName(capsule.ptr(), "used_dltensor");
+    py::capsule owner(managed, [](void *ptr) {
+        auto *tensor = static_cast<dlpack::DLManagedTensor *>(ptr);
+        if (tensor->deleter)
+            tensor->deleter(tensor);
+    });
+
+    std::vector<py::ssize_t> shape(t.shape, t.shape + t.ndim);
+    std::vector<py::ssize_t> strides(t.ndim);
+    py::ssize_t stride = dtype.itemsize();
+    for (int i = t.ndim; i-- > 0;) {
+        strides[i] = t.strides ? py::ssize_t(t.strides[i]) * dtype.itemsize() : stride;
+        stride *= shape[i];
+    }
+    return py::array(dtype, shape, strides, static_cast<const char *>(t.data) + t.byte_offset, owner);
+}
+
+
+/* Per-channel statistics as a dict of NumPy arrays */
+py::dict stats_dict(const texture_stats &stats) {
+    const size_t channels = stats.channels.size();
+    py::array_t<double> min(channels), max(channels), mean(channels), stddev(channels);
+    py::array_t<std::uint64_t> count(channels), nan(channels), inf(channels);
+    py::array_t<std::uint64_t> histogram(std::vector<size_t>{channels, STATS_BINS});
+    double *min_ptr = min.mutable_data(), *max_ptr = max.mutable_data();
+    double *mean_ptr = mean.mutable_data(), *std_ptr = stddev.mutable_data();
+    std::uint64_t *count_ptr = count.mutable_data(), *nan_ptr = nan.mutable_data(), *inf_ptr = inf.mutable_data();
+    std::uint64_t *histogram_ptr = histogram.mutable_data();
+    for (size_t c = 0; c < channels; c++) {
+        const channel_stats &s = stats.channels[c];
+        min_ptr[c] = s.min;
+        max_ptr[c] = s.max;
+        mean_ptr[c] = s.mean();
+        std_ptr[c] = s.stddev();
+        count_ptr[c] = s.count;
+        nan_ptr[c] = s.nan;
+        inf_ptr[c] = s.inf;
+        std::copy(s.histogram.begin(), s.histogram.end(), histogram_ptr + c * STATS_BINS);
+    }
+    py::dict out;
+    out["min"] = min;
+    out["max"] = max;
+    out["mean"] = mean;
+    out["std"] = stddev;
+    out["count"] = count;
+    out["nan"] = nan;
+    out["inf"] = inf;
+    out["histogram"] = histogram;
+    return out;
+}
+
+
+/* Returns the array, plus the SharedArray handle when `shared` and the statistics dict when `stats` */
+py::object load(std::string &filepath, const std::string &layout_name, bool shared, py::object size, const std::string &filter_name,
+                bool stats, bool as_dlpack) {
+    const bool planar = is_planar(layout_name, false);
+    const resize_filter filter = parse_resize_filter(filter_name);
     if (!file_exists(filepath)){
         throw std::invalid_argument("File doesn't exist");
     }
-    gli::texture tex = gli::load(filepath);
-    assert(!tex.empty());
-    auto format = tex.format();
-    auto extent = tex.extent();
-    std::vector<int> shape = {extent.y, extent.x};
+    texture_stats gathered;
+    texture_stats *stats_out = stats ? &gathered : nullptr;
+    const auto wh = parse_size(size);
+    if (as_dlpack) {
+        if (shared || stats)
+            throw std::invalid_argument("as_dlpack=True can't be combined with shared or stats");
+        native_image image;
+        {
+            py::gil_scoped_release release;
+            image = decode_image(filepath, planar, wh.first, wh.second, filter, 0);
+        }
+        return to_dlpack(std::move(image));
+    }
     py::array arr;
-    py::array_t<std::uint16_t> half_arr;
+    if (!wh.first)
+        arr = load_array(filepath, planar, shared, stats_out);
+    else
+        arr = load_resized(filepath, planar, shared, wh.first, wh.second, filter, stats_out);
+    if (shared && stats)
+        return py::make_tuple(arr, arr.base(), stats_dict(gathered));
+    if (shared)
+        return py::make_tuple(arr, arr.base());
+    if (stats)
+        return py::make_tuple(arr, stats_dict(gathered));
+    return arr;
+}
 
-    switch(format) {
-      case gli::FORMAT_R8_UNORM_PACK8:
-            shape.push_back(1);
-            arr = py::array_t<std::uint8_t>(shape, (std::uint8_t *) tex.data());
-            break;
-      case gli::FORMAT_R8_SNORM_PACK8:
-            shape.push_back(1);
-            arr = py::array_t<std::int8_t>(shape, (std::int8_t *) tex.data());
-            break;
-      case gli::FORMAT_R8_USCALED_PACK8:
-            shape.push_back(1);
-            arr = py::array_t<std::uint8_t>(shape, (std::uint8_t *) tex.data());
-            break;
-      case gli::FORMAT_R8_SSCALED_PACK8:
-            shape.push_back(1);
-            arr = py::array_t<std::int8_t>(shape, (std::int8_t *) tex.data());
-            break;
-      case gli::FORMAT_R8_UINT_PACK8:
-            shape.push_back(1);
-            arr = py::array_t<std::uint8_t>(shape, (std::uint8_t *) tex.data());
-            break;
-      case gli::FORMAT_R8_SINT_PACK8:
-            shape.push_back(1);
-            arr = py::array_t<std::int8_t>(shape, (std::int8_t *) tex.data());
-            break;
-      case gli::FORMAT_R8_SRGB_PACK8:
-            shape.push_back(1);
-            arr = py::array_t<std::uint8_t>(shape, (std::uint8_t *) tex.data());
-            break;
 
-      case gli::FORMAT_RG8_UNORM_PACK8:
-            shape.push_back(2);
-            arr = py::array_t<std::uint8_t>(shape, (std::uint8_t *) tex.data());
-            break;
-      case gli::FORMAT_RG8_SNORM_PACK8:
-            shape.push_back(2);
-            arr = py::array_t<std::int8_t>(shape, (std::int8_t *) tex.data());
-            break;
-      case gli::FORMAT_RG8_USCALED_PACK8:
-            shape.push_back(2);
-            arr = py::array_t<std::uint8_t>(shape, (std::uint8_t *) tex.data());
-            break;
-      case gli::FORMAT_RG8_SSCALED_PACK8:
-            shape.push_back(2);
-            arr = py::array_t<std::int8_t>(shape, (std::int8_t *) tex.data());
-            break;
-      case gli::FORMAT_RG8_UINT_PACK8:
-            shape.push_back(2);
-            arr = py::array_t<std::uint8_t>(shape, (std::uint8_t *) tex.data());
-            break;
-      case gli::FORMAT_RG8_SINT_PACK8:
-            shape.push_back(2);
-            arr = py::array_t<std::int8_t>(shape, (std::int8_t *) tex.data());
-            break;
-      case gli::FORMAT_RG8_SRGB_PACK8:
-            shape.push_back(2);
-            arr = py::array_t<std::uint8_t>(shape, (std::uint8_t *) tex.data());
-            break;
+/* Statistics of the first image of level 0 without keeping its pixels */
+py::dict stats_of(const std::string &filepath) {
+    if (!file_exists(filepath))
+        throw std::invalid_argument("File doesn't exist: " + filepath);
+    texture_stats stats;
+    {
+        // KTX2 decodes only level 0, stb images are read where stb decoded them
+        py::gil_scoped_release release;
+        const level_image image = read_level_image(filepath, 0, 0);
+        const auto &layout = get_texel_layout(image.format);
+        layout.load_stats(image.data, nullptr, size_t(image.extent.x) * image.extent.y, false, stats);
+    }
+    return stats_dict(stats);
+}
 
-      case gli::FORMAT_RGB8_UNORM_PACK8:
-            shape.push_back(3);
-            arr = py::array_t<std::uint8_t>(shape, (std::uint8_t *) tex.data());
-            break;
-      case gli::FORMAT_RGB8_SNORM_PACK8:
-            shape.push_back(3);
-            arr = py::array_t<std::int8_t>(shape, (std::int8_t *) tex.data());
-            break;
-      case gli::FORMAT_RGB8_USCALED_PACK8:
-            shape.push_back(3);
-            arr = py::array_t<std::uint8_t>(shape, (std::uint8_t *) tex.data());
-            break;
-      case gli::FORMAT_RGB8_SSCALED_PACK8:
-            shape.push_back(3);
-            arr = py::array_t<std::int8_t>(shape, (std::int8_t *) tex.data());
-            break;
-      case gli::FORMAT_RGB8_UINT_PACK8:
-            shape.push_back(3);
-            arr = py::array_t<std::uint8_t>(shape, (std::uint8_t *) tex.data());
-            break;
-      case gli::FORMAT_RGB8_SINT_PACK8:
-            shape.push_back(3);
-            arr = py::array_t<std::int8_t>(shape, (std::int8_t *) tex.data());
-            break;
-      case gli::FORMAT_RGB8_SRGB_PACK8:
-            shape.push_back(3);
-            arr = py::array_t<std::uint8_t>(shape, (std::uint8_t *) tex.data());
-            break;
 
-      case gli::FORMAT_BGR8_UNORM_PACK8:
-            shape.push_back(3);
-            arr = py::array_t<std::uint8_t>(shape, (std::uint8_t *) tex.data());
-            break;
-      case gli::FORMAT_BGR8_SNORM_PACK8:
-            shape.push_back(3);
-            arr = py::array_t<std::int8_t>(shape, (std::int8_t *) tex.data());
-            break;
-      case gli::FORMAT_BGR8_USCALED_PACK8:
-            shape.push_back(3);
-            arr = py::array_t<std::uint8_t>(shape, (std::uint8_t *) tex.data());
-            break;
-      case gli::FORMAT_BGR8_SSCALED_PACK8:
-            shape.push_back(3);
-            arr = py::array_t<std::int8_t>(shape, (std::int8_t *) tex.data());
-            break;
-      case gli::FORMAT_BGR8_UINT_PACK8:
-            shape.push_back(3);
-            arr = py::array_t<std::uint8_t>(shape, (std::uint8_t *) tex.data());
-            break;
-      case gli::FORMAT_BGR8_SINT_PACK8:
-            shape.push_back(3);
-            arr = py::array_t<std::int8_t>(shape, (std::int8_t *) tex.data());
-            break;
-      case gli::FORMAT_BGR8_SRGB_PACK8:
-            shape.push_back(3);
-            arr = py::array_t<std::uint8_t>(shape, (std::uint8_t *) tex.data());
-            break;
+py::object load_batch(const std::vector<std::string> &paths, py::object out, const std::string &layout_name, size_t num_threads, bool shared) {
+    if (paths.empty())
+        throw std::invalid_argument("No paths given");
+    if (shared && !out.is_none())
+        throw std::invalid_argument("shared=True allocates its own output, don't pass out");
+    const bool planar = is_planar(layout_name, true);
+    for (const auto &path : paths) {
+        if (!file_exists(path))
+            throw std::invalid_argument("File doesn't exist: " + path);
+    }
 
-      case gli::FORMAT_RGBA8_UNORM_PACK8:
-            shape.push_back(4);
-            arr = py::array_t<std::uint8_t>(shape, (std::uint8_t *) tex.data());
-            break;
-      case gli::FORMAT_RGBA8_SNORM_PACK8:
-            shape.push_back(4);
-            arr = py::array_t<std::int8_t>(shape, (std::int8_t *) tex.data());
-            break;
-      case gli::FORMAT_RGBA8_USCALED_PACK8:
-            shape.push_back(4);
-            arr = py::array_t<std::uint8_t>(shape, (std::uint8_t *) tex.data());
-            break;
-      case gli::FORMAT_RGBA8_SSCALED_PACK8:
-            shape.push_back(4);
-            arr = py::array_t<std::int8_t>(shape, (std::int8_t *) tex.data());
-            break;
-      case gli::FORMAT_RGBA8_UINT_PACK8:
-            shape.push_back(4);
-            arr = py::array_t<std::uint8_t>(shape, (std::uint8_t *) tex.data());
-            break;
-      case gli::FORMAT_RGBA8_SINT_PACK8:
-            shape.push_back(4);
-            arr = py::array_t<std::int8_t>(shape, (std::int8_t *) tex.data());
-            break;
-      case gli::FORMAT_RGBA8_SRGB_PACK8:
-            shape.push_back(4);
-            arr = py::array_t<std::uint8_t>(shape, (std::uint8_t *) tex.data());
-            break;
+    // Header pass, every texture must match the first
+    std::vector<texture_header> headers(paths.size());
+    {
+        py::gil_scoped_release release;
+        parallel_for(paths.size(), num_threads, [&](size_t i) {
+            headers[i] = read_header(paths[i]);
+        });
+    }
+    const texture_header &first = headers[0];
+    for (size_t i = 1; i < paths.size(); i++) {
+        if (headers[i].format != first.format || headers[i].extent != first.extent)
+            throw std::invalid_argument("Shape / format mismatch in batch: " + paths[i]);
+    }
 
-      case gli::FORMAT_RGBA8_UNORM_PACK32:
-            shape.push_back(4);
-            arr = py::array_t<std::uint8_t>(shape, (std::uint8_t *) tex.data());
-            break;
-      case gli::FORMAT_RGBA8_SNORM_PACK32:
-            shape.push_back(4);
-            arr = py::array_t<std::int8_t>(shape, (std::int8_t *) tex.data());
-            break;
-      case gli::FORMAT_RGBA8_USCALED_PACK32:
-            shape.push_back(4);
-            arr = py::array_t<std::uint8_t>(shape, (std::uint8_t *) tex.data());
-            break;
-      case gli::FORMAT_RGBA8_SSCALED_PACK32:
-            shape.push_back(4);
-            arr = py::array_t<std::int8_t>(shape, (std::int8_t *) tex.data());
-            break;
-      case gli::FORMAT_RGBA8_UINT_PACK32:
-            shape.push_back(4);
-            arr = py::array_t<std::uint8_t>(shape, (std::uint8_t *) tex.data());
-            break;
-      case gli::FORMAT_RGBA8_SINT_PACK32:
-            shape.push_back(4);
-            arr = py::array_t<std::int8_t>(shape, (std::int8_t *) tex.data());
-            break;
-      case gli::FORMAT_RGBA8_SRGB_PACK32:
-            shape.push_back(4);
-            arr = py::array_t<std::uint8_t>(shape, (std::uint8_t *) tex.data());
-            break;
+    const auto layout = get_texel_layout(first.format);
+    const size_t height = first.extent.y;
+    const size_t width = first.extent.x;
+    const size_t pixels = height * width;
+    const size_t image_bytes = pixels * layout.channels * layout.itemsize;
+    std::vector<size_t> shape = image_shape(height, width, layout.channels, planar);
+    shape.insert(shape.begin(), paths.size());
+    py::dtype dtype(layout.dtype);
 
-      case gli::FORMAT_R16_UNORM_PACK16:
-            shape.push_back(1);
-            arr = py::array_t<std::uint16_t>(shape, (std::uint16_t *) tex.data());
-            break;
-      case gli::FORMAT_R16_SNORM_PACK16:
-            shape.push_back(1);
-            arr = py::array_t<std::int16_t>(shape, (std::int16_t *) tex.data());
-            break;
-      case gli::FORMAT_R16_USCALED_PACK16:
-            shape.push_back(1);
-            arr = py::array_t<std::uint16_t>(shape, (std::uint16_t *) tex.data());
-            break;
-      case gli::FORMAT_R16_SSCALED_PACK16:
-            shape.push_back(1);
-            arr = py::array_t<std::int16_t>(shape, (std::int16_t *) tex.data());
-            break;
-      case gli::FORMAT_R16_UINT_PACK16:
-            shape.push_back(1);
-            arr = py::array_t<std::uint16_t>(shape, (std::uint16_t *) tex.data());
-            break;
-      case gli::FORMAT_R16_SINT_PACK16:
-            shape.push_back(1);
-            arr = py::array_t<std::int16_t>(shape, (std::int16_t *) tex.data());
-            break;
-      case gli::FORMAT_R16_SFLOAT_PACK16:
-            shape.push_back(1);
-            half_arr = py::array_t<std::uint16_t>(shape, (std::uint16_t *) tex.data());
-            arr = half_to_float(half_arr);
-            break;
+    // Output Array
+    py::array arr;
+    if (out.is_none()) {
+        arr = allocate(layout.dtype, shape, shared);
+    } else {
+        arr = out.cast<py::array>();
+        if (arr.ndim() != 4 || !std::equal(shape.begin(), shape.end(), arr.shape()))
+            throw std::invalid_argument("Output array has the wrong shape");
+        if (arr.dtype().kind() != dtype.kind() || arr.dtype().itemsize() != dtype.itemsize())
+            throw std::invalid_argument("Output array has the wrong dtype");
+        if (!(arr.flags() & py::array::c_style) || !arr.writeable())
+            throw std::invalid_argument("Output array must be C-contiguous and writeable");
+    }
 
-      case gli::FORMAT_RG16_UNORM_PACK16:
-            shape.push_back(2);
-            arr = py::array_t<std::uint16_t>(shape, (std::uint16_t *) tex.data());
-            break;
-      case gli::FORMAT_RG16_SNORM_PACK16:
-            shape.push_back(2);
-            arr = py::array_t<std::int16_t>(shape, (std::int16_t *) tex.data());
-            break;
-      case gli::FORMAT_RG16_USCALED_PACK16:
-            shape.push_back(2);
-            arr = py::array_t<std::uint16_t>(shape,(std::uint16_t *) tex.data());
-            break;
-      case gli::FORMAT_RG16_SSCALED_PACK16:
-            shape.push_back(2);
-            arr = py::array_t<std::int16_t>(shape, (std::int16_t *) tex.data());
-            break;
-      case gli::FORMAT_RG16_UINT_PACK16:
-            shape.push_back(2);
-            arr = py::array_t<std::uint16_t>(shape, (std::uint16_t *) tex.data());
-            break;
-      case gli::FORMAT_RG16_SINT_PACK16:
-            shape.push_back(2);
-            arr = py::array_t<std::int16_t>(shape, (std::int16_t *) tex.data());
-            break;
-      case gli::FORMAT_RG16_SFLOAT_PACK16:
-            shape.push_back(2);
-            half_arr = py::array_t<std::uint16_t>(shape, (std::uint16_t *) tex.data());
-            arr = half_to_float(half_arr);
-            break;
+    // Decode each texture straight into its slice
+    auto *dst = static_cast<std::uint8_t *>(arr.mutable_data());
+    {
+        py::gil_scoped_release release;
+        parallel_for(paths.size(), num_threads, [&](size_t i) {
+            std::uint8_t *slot = dst + i * image_bytes;
+            const container kind = sniff_container(paths[i]);
+            if (kind == container::image) {
+                const stb::image image = stb::load(paths[i]);
+                if (image.format != first.format || image.width != width || image.height != height)
+                    throw std::invalid_argument("Shape / format mismatch in batch: " + paths[i]);
+                layout.load(image.pixels.get(), slot, pixels, planar);
+                return;
+            }
+            if (kind == container::ktx2) {
+                // Only the first image of level 0 is decompressed, into the slot itself when it needs no conversion
+                ktx2::reader reader(paths[i]);
+                if (reader.format() != first.format || reader.extent() != first.extent)
+                    throw std::invalid_argument("Shape / format mismatch in batch: " + paths[i]);
+                if (layout.as_stored() && !(planar && layout.channels > 1)) {
+                    reader.read_level(0, slot, image_bytes);
+                    return;
+                }
+                pool::buffer scratch = pool::acquire(pixels * gli::block_size(first.format));
+                reader.read_level(0, scratch.data(), scratch.size());
+                layout.load(scratch.data(), slot, pixels, planar);
+                return;
+            }
+            gli::texture tex = load_texture(paths[i], 1);
+            if (tex.format() != first.format || tex.extent() != first.extent)
+                throw std::invalid_argument("Shape / format mismatch in batch: " + paths[i]);
+            layout.load(tex.data(), slot, pixels, planar);
+        });
+    }
+    if (shared)
+        return py::make_tuple(arr, arr.base());
+    return arr;
+}
 
-      case gli::FORMAT_RGB16_UNORM_PACK16:
-            shape.push_back(3);
-            arr = py::array_t<std::uint16_t>(shape, (std::uint16_t *) tex.data());
-            break;
-      case gli::FORMAT_RGB16_SNORM_PACK16:
-            shape.push_back(3);
-            arr = py::array_t<std::int16_t>(shape, (std::int16_t *) tex.data());
-            break;
-      case gli::FORMAT_RGB16_USCALED_PACK16:
-            shape.push_back(3);
-            arr = py::array_t<std::uint16_t>(shape, (std::uint16_t *) tex.data());
-            break;
-      case gli::FORMAT_RGB16_SSCALED_PACK16:
-            shape.push_back(3);
-            arr = py::array_t<std::int16_t>(shape, (std::int16_t *) tex.data());
-            break;
-      case gli::FORMAT_RGB16_UINT_PACK16:
-            shape.push_back(3);
-            arr = py::array_t<std::uint16_t>(shape, (std::uint16_t *) tex.data());
-            break;
-      case gli::FORMAT_RGB16_SINT_PACK16:
-            shape.push_back(3);
-            arr = py::array_t<std::int16_t>(shape, (std::int16_t *) tex.data());
-            break;
-      case gli::FORMAT_RGB16_SFLOAT_PACK16:
-            shape.push_back(3);
-            half_arr = py::array_t<std::uint16_t>(shape, (std::uint16_t *) tex.data());
-            arr = half_to_float(half_arr);
-            break;
 
-      case gli::FORMAT_RGBA16_UNORM_PACK16:
-            shape.push_back(4);
-            arr = py::array_t<std::uint16_t>(shape, (std::uint16_t *) tex.data());
-            break;
-      case gli::FORMAT_RGBA16_SNORM_PACK16:
-            shape.push_back(4);
-            arr = py::array_t<std::int16_t>(shape, (std::int16_t *) tex.data());
-            break;
-      case gli::FORMAT_RGBA16_USCALED_PACK16:
-            shape.push_back(4);
-            arr = py::array_t<std::uint16_t>(shape, (std::uint16_t *) tex.data());
-            break;
-      case gli::FORMAT_RGBA16_SSCALED_PACK16:
-            shape.push_back(4);
-            arr = py::array_t<std::int16_t>(shape, (std::int16_t *) tex.data());
-            break;
-      case gli::FORMAT_RGBA16_UINT_PACK16:
-            shape.push_back(4);
-            arr = py::array_t<std::uint16_t>(shape, (std::uint16_t *) tex.data());
-            break;
-      case gli::FORMAT_RGBA16_SINT_PACK16:
-            shape.push_back(4);
-            arr = py::array_t<std::int16_t>(shape, (std::int16_t *) tex.data());
-            break;
-      case gli::FORMAT_RGBA16_SFLOAT_PACK16:
-            shape.push_back(4);
-            half_arr = py::array_t<std::uint16_t>(shape, (std::uint16_t *) tex.data());
-            arr = half_to_float(half_arr);
-            break;
+/* iterate(): decodes ahead on native threads, each __next__ takes the next ready image */
+class texture_iterator {
+public:
+    texture_iterator(std::vector<std::string> paths, size_t prefetch, size_t num_threads, bool ordered, bool yield_errors,
+                     bool planar, size_t width, size_t height, resize_filter filter)
+        : paths_(std::move(paths)), ordered_(ordered), yield_errors_(yield_errors),
+          queue_(paths_.size(), prefetch, num_threads, ordered, [this, planar, width, height, filter](size_t i) {
+              // Already one of num_threads decode workers, so each image is resampled on this thread
+              return decode_image(paths_[i], planar, width, height, filter, 1);
+          }) {}
+
+    /* The array (ordered) or (path, array), with the file's exception in place of the array when errors="yield" */
+    py::object next() {
+        prefetch_queue<native_image>::item item;
+        bool more;
+        {
+            py::gil_scoped_release release;
+            more = queue_.next(item);
+        }
+        if (!more)
+            throw py::stop_iteration();
+
+        const std::string &path = paths_[item.index];
+        py::object value;
+        if (item.error) {
+            // Only this file failed, the iterator carries on from the next one
+            bool value_error = false;
+            std::string message = path + ": ";
+            try {
+                std::rethrow_exception(item.error);
+            } catch (const std::invalid_argument &e) {
+                value_error = true;
+                message += e.what();
+            } catch (const std::exception &e) {
+                message += e.what();
+            }
+            if (!yield_errors_) {
+                if (value_error)
+                    throw std::invalid_argument(message);
+                throw std::runtime_error(message);
+            }
+            value = py::reinterpret_borrow<py::object>(value_error ? PyExc_ValueError : PyExc_RuntimeError)(message);
+        } else {
+            value = item.value.to_array();
+        }
+        if (ordered_)
+            return value;
+        return py::make_tuple(path, value);
+    }
 
-      case gli::FORMAT_R32_UINT_PACK32:
-            shape.push_back(1);
-            arr = py::array_t<std::uint32_t>(shape, (std::uint32_t *) tex.data());
-            break;
-      case gli::FORMAT_R32_SINT_PACK32:
-            shape.push_back(1);
-            arr = py::array_t<std::int32_t>(shape, (std::int32_t *) tex.data());
-            break;
-      case gli::FORMAT_R32_SFLOAT_PACK32:
-            shape.push_back(1);
-            arr = py::array_t<float>(shape, (float *) tex.data());
-            break;
+    void close() {
+        py::gil_scoped_release release;
+        queue_.close();
+    }
 
-      case gli::FORMAT_RG32_UINT_PACK32:
-            shape.push_back(2);
-            arr = py::array_t<std::uint32_t>(shape, (std::uint32_t *) tex.data());
-            break;
-      case gli::FORMAT_RG32_SINT_PACK32:
-            shape.push_back(2);
-            arr = py::array_t<std::int32_t>(shape, (std::int32_t *) tex.data());
-            break;
-      case gli::FORMAT_RG32_SFLOAT_PACK32:
-            shape.push_back(2);
-            arr = py::array_t<float>(shape, (float *) tex.data());
-            break;
+    size_t size() const { return paths_.size(); }
+
+private:
+    const std::vector<std::string> paths_;
+    const bool ordered_;
+    const bool yield_errors_;
+    prefetch_queue<native_image> queue_;
+};
+
+
+std::unique_ptr<texture_iterator> iterate(const std::vector<std::string> &paths, size_t prefetch, size_t num_threads, bool ordered,
+                                          const std::string &errors, const std::string &layout_name, py::object size,
+                                          const std::string &filter_name) {
+    const bool planar = is_planar(layout_name, false);
+    const resize_filter filter = parse_resize_filter(filter_name);
+    const auto wh = parse_size(size);
+    if (errors != "raise" && errors != "yield")
+        throw std::invalid_argument("errors must be 'raise' or 'yield'");
+    if (prefetch == 0)
+        throw std::invalid_argument("prefetch must be at least 1");
+    return std::unique_ptr<texture_iterator>(
+        new texture_iterator(paths, prefetch, num_threads, ordered, errors == "yield", planar, wh.first, wh.second, filter));
+}
 
-      case gli::FORMAT_RGB32_UINT_PACK32:
-            shape.push_back(3);
-            arr = py::array_t<std::uint32_t>(shape, (std::uint32_t *) tex.data());
-            break;
-      case gli::FORMAT_RGB32_SINT_PACK32:
-            shape.push_back(3);
-            arr = py::array_t<std::int32_t>(shape, (std::int32_t *) tex.data());
-            break;
-      case gli::FORMAT_RGB32_SFLOAT_PACK32:
-            shape.push_back(3);
-            arr = py::array_t<float>(shape, (float *) tex.data());
-            break;
 
-      case gli::FORMAT_RGBA32_UINT_PACK32:
-            shape.push_back(4);
-            arr = py::array_t<std::uint32_t>(shape, (std::uint32_t *) tex.data());
-            break;
-      case gli::FORMAT_RGBA32_SINT_PACK32:
-            shape.push_back(4);
-            arr = py::array_t<std::int32_t>(shape, (std::int32_t *) tex.data());
-            break;
-      case gli::FORMAT_RGBA32_SFLOAT_PACK32:
-            shape.push_back(4);
-            arr = py::array_t<float>(shape, (float *) tex.data());
-            break;
+/* A compare() operand, keeping whatever owns the viewed memory alive */
+struct compare_operand {
+    level_image image;
+    pool::buffer reordered;     // BGR textures, in RGB order
+    py::array array;
+    compare::image_view view;
+};
+
+
+/* A path is decoded and compared in its stored type (first image of level 0), an array through its strides */
+compare_operand compare_input(py::object obj) {
+    compare_operand out;
+    compare::image_view &view = out.view;
+    if (py::isinstance<py::str>(obj)) {
+        const std::string filepath = obj.cast<std::string>();
+        if (!file_exists(filepath))
+            throw std::invalid_argument("File doesn't exist: " + filepath);
+        {
+            // Only the compared image is decoded: a KTX2 file's first level, stb pixels where stb left them
+            py::gil_scoped_release release;
+            out.image = read_level_image(filepath, 0, 0);
+        }
+        const auto &layout = get_texel_layout(out.image.format);
+        const py::dtype dtype(layout.dtype);
+        view.data = static_cast<const std::uint8_t *>(out.image.data);
+        view.type = layout.half ? compare::element::f16 : compare::element_type(dtype.kind(), dtype.itemsize());
+        view.height = out.image.extent.y;
+        view.width = out.image.extent.x;
+        if (layout.bgr) {
+            // Channels are compared in the order load() returns them, so arrays compare against files
+            out.reordered = pool::acquire(view.height * view.width * layout.texel_size);
+            layout.load(view.data, out.reordered.data(), view.height * view.width, false);
+            view.data = out.reordered.data();
+        }
+        view.channels = layout.channels;
+        view.texel_stride = std::ptrdiff_t(layout.texel_size);
+        view.channel_stride = std::ptrdiff_t(layout.texel_size / layout.channels);
+        view.row_stride = std::ptrdiff_t(view.width) * view.texel_stride;
+        return out;
+    }
 
-      case gli::FORMAT_R64_UINT_PACK64:
-            shape.push_back(1);
-            arr = py::array_t<std::uint64_t>(shape, (std::uint64_t *) tex.data());
-            break;
-      case gli::FORMAT_R64_SINT_PACK64:
-            shape.push_back(1);
-            arr = py::array_t<std::int64_t>(shape, (std::int64_t *) tex.data());
-            break;
-      case gli::FORMAT_R64_SFLOAT_PACK64:
-            shape.push_back(1);
-            arr = py::array_t<double>(shape, (double *) tex.data());
-            break;
+    out.array = py::array::ensure(obj);
+    if (!out.array)
+        throw std::invalid_argument("compare() takes file paths or arrays");
+    const py::array &arr = out.array;
+    if (arr.ndim() != 2 && arr.ndim() != 3)
+        throw std::invalid_argument("Arrays must be [H,W] or [H,W,C]");
+    view.data = static_cast<const std::uint8_t *>(arr.data());
+    view.type = compare::element_type(arr.dtype().kind(), arr.itemsize());
+    view.height = arr.shape(0);
+    view.width = arr.shape(1);
+    view.channels = arr.ndim() == 3 ? arr.shape(2) : 1;
+    view.row_stride = arr.strides(0);
+    view.texel_stride = arr.strides(1);
+    view.channel_stride = arr.ndim() == 3 ? arr.strides(2) : 0;
+    return out;
+}
 
-      case gli::FORMAT_RG64_UINT_PACK64:
-            shape.push_back(2);
-            arr = py::array_t<std::uint64_t>(shape, (std::uint64_t *) tex.data());
-            break;
-      case gli::FORMAT_RG64_SINT_PACK64:
-            shape.push_back(2);
-            arr = py::array_t<std::int64_t>(shape, (std::int64_t *) tex.data());
-            break;
-      case gli::FORMAT_RG64_SFLOAT_PACK64:
-            shape.push_back(2);
-            arr = py::array_t<double>(shape, (double *) tex.data());
-            break;
 
-      case gli::FORMAT_RGB64_UINT_PACK64:
-            shape.push_back(3);
-            arr = py::array_t<std::uint64_t>(shape, (std::uint64_t *) tex.data());
-            break;
-      case gli::FORMAT_RGB64_SINT_PACK64:
-            shape.push_back(3);
-            arr = py::array_t<std::int64_t>(shape, (std::int64_t *) tex.data());
-            break;
-      case gli::FORMAT_RGB64_SFLOAT_PACK64:
-            shape.push_back(3);
-            arr = py::array_t<double>(shape, (double *) tex.data());
-            break;
+/* Per-channel metrics between two images, each a file path or an array */
+py::dict compare_images(py::object a, py::object b, const std::vector<std::string> &metrics, py::object data_range, size_t num_threads) {
+    compare::options opts;
+    for (const auto &metric : metrics) {
+        if (metric == "mse")
+            opts.mse = true;
+        else if (metric == "psnr")
+            opts.psnr = true;
+        else if (metric == "maxabs")
+            opts.maxabs = true;
+        else if (metric == "ssim")
+            opts.ssim = true;
+        else
+            throw std::invalid_argument("Unrecognised Metric: " + metric);
+    }
+    opts.data_range = data_range.is_none() ? 0.0 : data_range.cast<double>();
+    opts.num_threads = num_threads;
+
+    const compare_operand lhs = compare_input(a);
+    const compare_operand rhs = compare_input(b);
+    compare::result result;
+    {
+        py::gil_scoped_release release;
+        result = compare::compare(lhs.view, rhs.view, opts);
+    }
 
-      case gli::FORMAT_RGBA64_UINT_PACK64:
-            shape.push_back(4);
-            arr = py::array_t<std::uint64_t>(shape, (std::uint64_t *) tex.data());
-            break;
-      case gli::FORMAT_RGBA64_SINT_PACK64:
-            shape.push_back(4);
-            arr = py::array_t<std::int64_t>(shape, (std::int64_t *) tex.data());
-            break;
-      case gli::FORMAT_RGBA64_SFLOAT_PACK64:
-            shape.push_back(4);
-            arr = py::array_t<double>(shape, (double *) tex.data());
-            break;
+    py::dict out;
+    const std::pair<const char *, const std::vector<double> *> values[] = {
+        {"mse", &result.mse}, {"psnr", &result.psnr}, {"maxabs", &result.maxabs}, {"ssim", &result.ssim}};
+    for (const auto &value : values) {
+        if (value.second->empty())
+            continue;
+        py::array_t<double> arr(value.second->size());
+        std::copy(value.second->begin(), value.second->end(), arr.mutable_data());
+        out[value.first] = arr;
+    }
+    return out;
+}
 
-      //TODO:
-      // FORMAT_RG11B10_UFLOAT_PACK32,
-      // FORMAT_RGB9E5_UFLOAT_PACK32,
-      // FORMAT_D16_UNORM_PACK16,
-      // FORMAT_D24_UNORM_PACK32,
-      // FORMAT_D32_SFLOAT_PACK32,
-      // FORMAT_S8_UINT_PACK8,
-      // FORMAT_D16_UNORM_S8_UINT_PACK32,
-      // FORMAT_D24_UNORM_S8_UINT_PACK32,
-      // FORMAT_D32_SFLOAT_S8_UINT_PACK64
 
-        default:
-            throw std::invalid_argument("Unrecognised Load Format");
+/* Pack[key] / Pack.load(): first image of level 0, a read-only view of the mapping when no conversion is needed */
+py::array pack_load(py::object self, const std::string &key, const std::string &layout_name) {
+    const bool planar = is_planar(layout_name, false);
+    const auto &reader = self.cast<const pack::reader &>();
+    const pack::entry *entry = reader.find(key);
+    if (!entry)
+        throw py::key_error(key);
+
+    // Only uncompressed formats have texel traits, and the image must lie within the entry's bytes
+    const auto layout = get_texel_layout(entry->tex_format());
+    const size_t pixels = size_t(entry->width) * entry->height;
+    if (pixels * gli::block_size(entry->tex_format()) > entry->size)
+        throw std::runtime_error("Corrupt pack entry: " + key);
+    std::vector<size_t> shape = image_shape(entry->height, entry->width, layout.channels, planar);
+    const void *src = reader.data(*entry);
+    if (layout.as_stored() && !(planar && layout.channels > 1)) {
+        py::array view(py::dtype(layout.dtype), shape, src, self);
+        view.attr("flags").attr("writeable") = false;
+        return view;
     }
 
+    py::array arr(py::dtype(layout.dtype), shape);
+    void *dst = arr.mutable_data();
+    {
+        py::gil_scoped_release release;
+        layout.load(src, dst, pixels, planar);
+    }
     return arr;
 }
 
 
-template <typename T>
-void write_texel(void *buf_ptr, gli::texture &tex, const gli::extent3d &coord, const size_t y, const size_t x, const size_t h_stride,  const size_t w_stride) {
-    const auto idx = y * (h_stride / sizeof(T)) + x * (w_stride / sizeof(T));
-    const T *texel = reinterpret_cast<T *>(buf_ptr);
-    tex.store<T>(coord, 0, 0, 0, texel[idx]);
+/* Decodes texture files in parallel and appends them to a pack, keyed by `names` (default: the paths) */
+void write_pack(const std::string &filepath, const std::vector<std::string> &paths, py::object names_arg, bool append, size_t num_threads) {
+    const std::vector<std::string> names = names_arg.is_none() ? paths : names_arg.cast<std::vector<std::string>>();
+    if (names.size() != paths.size())
+        throw std::invalid_argument("names and paths differ in length");
+    for (const auto &path : paths) {
+        if (!file_exists(path))
+            throw std::invalid_argument("File doesn't exist: " + path);
+    }
+
+    py::gil_scoped_release release;
+    pack::writer writer(filepath, append);
+    parallel_for(paths.size(), num_threads, [&](size_t i) {
+        if (sniff_container(paths[i]) == container::image) {
+            const stb::image image = stb::load(paths[i]);
+            writer.add(names[i], image.format, image.width, image.height, image.pixels.get());
+        } else {
+            writer.add(names[i], load_texture(paths[i], 1));
+        }
+    });
+    writer.close();
 }
 
 
-bool save(std::string filepath, py::array array, gli::format format) {
-    py::buffer_info buf = array.request();
-    if (buf.ndim != 3)
-        throw std::runtime_error("Number of dimensions must be 3");
-    
-    // Create Texture 
-    gli::extent3d ext = {buf.shape[1], buf.shape[0], 1};
-    gli::texture tex = gli::texture(gli::TARGET_3D, format, ext, 1, 1, 1);
+/* How the leading dimensions of a save() array map onto the layers / faces / depth of a texture */
+struct save_shape {
+    gli::target target = gli::TARGET_3D;
+    size_t layers = 1;
+    size_t faces = 1;
+    size_t depth = 1;
+
+    size_t slices() const { return layers * faces * depth; }
+};
+
+
+save_shape get_save_shape(const py::array &array, py::object target_arg) {
+    save_shape out;
+    const size_t leading = array.ndim() - 3;
+    switch (array.ndim()) {
+        case 3:
+            out.target = target_arg.is_none() ? gli::TARGET_3D : target_arg.cast<gli::target>();
+            if (out.target != gli::TARGET_2D && out.target != gli::TARGET_3D)
+                throw std::invalid_argument("3D arrays can only be saved as TARGET_2D or TARGET_3D");
+            break;
+        case 4:
+            out.target = target_arg.is_none() ? gli::TARGET_2D_ARRAY : target_arg.cast<gli::target>();
+            if (out.target == gli::TARGET_2D_ARRAY)
+                out.layers = array.shape(0);
+            else if (out.target == gli::TARGET_CUBE)
+                out.faces = array.shape(0);
+            else if (out.target == gli::TARGET_3D)
+                out.depth = array.shape(0);
+            else
+                throw std::invalid_argument("4D arrays can only be saved as TARGET_2D_ARRAY, TARGET_CUBE or TARGET_3D");
+            break;
+        case 5:
+            out.target = target_arg.is_none() ? gli::TARGET_CUBE_ARRAY : target_arg.cast<gli::target>();
+            if (out.target != gli::TARGET_CUBE_ARRAY)
+                throw std::invalid_argument("5D arrays can only be saved as TARGET_CUBE_ARRAY");
+            out.layers = array.shape(0);
+            out.faces = array.shape(1);
+            break;
+        default:
+            throw std::runtime_error("Number of dimensions must be 3, 4 or 5");
+    }
+    if ((out.target == gli::TARGET_CUBE || out.target == gli::TARGET_CUBE_ARRAY) && out.faces != 6)
+        throw std::invalid_argument("Cubemaps must have 6 faces");
+    if (leading > 0 && array.shape(0) == 0)
+        throw std::invalid_argument("Array has no layers");
+    return out;
+}
+
+
+/*
+ * Raises unless `channels` elements of `dtype` are the texels of `traits`, e.g. an int32 array
+ * given for R32_SFLOAT, which would otherwise be stored bit for bit. Half formats take the raw
+ * half bits as float16 or uint16.
+ */
+void check_save_dtype(size_t channels, const py::dtype &dtype, const format_traits &traits) {
+    const py::dtype expected(traits.half ? "e" : traits.dtype);
+    const bool kind_ok = dtype.kind() == expected.kind() || (traits.half && dtype.kind() == 'u');
+    if (channels != traits.channels || !kind_ok || size_t(dtype.itemsize()) != size_t(expected.itemsize()))
+        throw std::invalid_argument("Array channels / dtype (" + std::to_string(channels) + " x " + std::string(py::str(dtype))
+                                    + ") don't match the format (" + std::to_string(traits.channels) + " x "
+                                    + std::string(py::str(expected)) + ")");
+}
+
+
+/* Where a checked array's elements are and how they map onto the texture, everything fill_texture() needs without the GIL */
+struct save_layout {
+    const format_traits *traits = nullptr;
+    gli::format format = gli::FORMAT_UNDEFINED;
+    save_shape dims;
+    bool planar = false;
+    size_t leading = 0;
+    size_t channels = 0;
+    size_t height = 0;
+    size_t width = 0;
+    const std::uint8_t *data = nullptr;
+    size_t itemsize = 0;
+    std::vector<py::ssize_t> shape;
+    std::vector<py::ssize_t> strides;   // bytes
+    pool::buffer snapshot;              // owns `data` once snapshot_source() has copied the array
+};
+
+
+/* An array checked against a save format, kept alive while its layout is read */
+struct save_source {
+    py::array array;
+    save_layout layout;
+};
+
+
+save_source prepare_save(py::object array_arg, gli::format format, const std::string &layout, py::object target) {
+    // Arrays are used as they are, DLPack tensors (torch, JAX, ...) and capsules are viewed without a copy
+    save_source out;
+    py::array &array = out.array;
+    save_layout &src = out.layout;
+    if (py::isinstance<py::array>(array_arg))
+        array = array_arg.cast<py::array>();
+    else if (py::hasattr(array_arg, "__dlpack__"))
+        array = from_dlpack(array_arg.attr("__dlpack__")());
+    else if (py::isinstance<py::capsule>(array_arg))
+        array = from_dlpack(array_arg);
+    else
+        array = py::array::ensure(array_arg);
+    if (!array)
+        throw std::invalid_argument("save() takes a NumPy array or a tensor implementing __dlpack__");
+    src.format = format;
+    src.planar = is_planar(layout, false);
+    src.dims = get_save_shape(array, target);
+    src.leading = array.ndim() - 3;
+    src.traits = find_format_traits(format);
+    if (!src.traits)
+        throw std::invalid_argument("Unrecognised Save Format");
+
+    // Planar input is re-interleaved straight into the texture storage, so needs to be packed.
+    // Interleaved input only needs each texel's channels to be adjacent
+    if (src.planar || array.strides(array.ndim() - 1) != array.itemsize()) {
+        array = py::array::ensure(array, py::array::c_style);
+        if (!array)
+            throw std::runtime_error("Array could not be made contiguous");
+    }
+    src.data = static_cast<const std::uint8_t *>(array.data());
+    src.itemsize = size_t(array.itemsize());
+    src.shape.assign(array.shape(), array.shape() + array.ndim());
+    src.strides.assign(array.strides(), array.strides() + array.ndim());
 
     // NumPy Buffer info
-    const size_t height = array.shape(0);
-    const size_t width = array.shape(1);
-    const size_t h_stride = buf.strides[0];
-    const size_t w_stride = buf.strides[1];
+    const size_t leading = src.leading;
+    src.channels = src.planar ? src.shape[leading] : src.shape[leading + 2];
+    src.height = src.planar ? src.shape[leading + 1] : src.shape[leading];
+    src.width = src.planar ? src.shape[leading + 2] : src.shape[leading + 1];
+    check_save_dtype(src.channels, array.dtype(), *src.traits);
 
     // Log info
-    LOGD("Height: " + std::to_string(height));
-    LOGD("Width: " + std::to_string(width));
-    LOGD("Height Stride: " + std::to_string(h_stride));
-    LOGD("Width Stride: " + std::to_string(w_stride));
-
-    // Populate Texture 
-    //TODO: move switch-case out of the inner-loop
-    for (size_t y = 0; y < height; y++) {
-        for (size_t x = 0; x < width; x++) {
-            const gli::extent3d coord(x, y, 0);
-            switch(format){
-                case gli::FORMAT_R8_UNORM_PACK8:
-                    write_texel<glm::u8>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_R8_SNORM_PACK8:
-                    write_texel<glm::i8>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_R8_USCALED_PACK8:
-                    write_texel<glm::u8>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_R8_SSCALED_PACK8:
-                    write_texel<glm::i8>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_R8_UINT_PACK8:
-                    write_texel<glm::u8>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_R8_SINT_PACK8:
-                    write_texel<glm::i8>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_R8_SRGB_PACK8:
-                    write_texel<glm::u8>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-
-                case gli::FORMAT_RG8_UNORM_PACK8:
-                    write_texel<glm::u8vec2>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RG8_SNORM_PACK8:
-                    write_texel<glm::i8vec2>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RG8_USCALED_PACK8:
-                    write_texel<glm::u8vec2>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RG8_SSCALED_PACK8:
-                    write_texel<glm::i8vec2>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RG8_UINT_PACK8:
-                    write_texel<glm::u8vec2>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RG8_SINT_PACK8:
-                    write_texel<glm::i8vec2>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RG8_SRGB_PACK8:
-                    write_texel<glm::u8vec2>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-
-                case gli::FORMAT_RGB8_UNORM_PACK8:
-                    write_texel<glm::u8vec3>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RGB8_SNORM_PACK8:
-                    write_texel<glm::i8vec3>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RGB8_USCALED_PACK8:
-                    write_texel<glm::u8vec3>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RGB8_SSCALED_PACK8:
-                    write_texel<glm::i8vec3>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RGB8_UINT_PACK8:
-                    write_texel<glm::u8vec3>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RGB8_SINT_PACK8:
-                    write_texel<glm::i8vec3>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RGB8_SRGB_PACK8:
-                    write_texel<glm::u8vec3>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-
-                case gli::FORMAT_BGR8_UNORM_PACK8:
-                    write_texel<glm::u8vec3>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_BGR8_SNORM_PACK8:
-                    write_texel<glm::i8vec3>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_BGR8_USCALED_PACK8:
-                    write_texel<glm::u8vec3>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_BGR8_SSCALED_PACK8:
-                    write_texel<glm::i8vec3>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_BGR8_UINT_PACK8:
-                    write_texel<glm::u8vec3>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_BGR8_SINT_PACK8:
-                    write_texel<glm::i8vec3>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_BGR8_SRGB_PACK8:
-                    write_texel<glm::u8vec3>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-
-                case gli::FORMAT_RGBA8_UNORM_PACK8:
-                    write_texel<glm::u8vec4>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RGBA8_SNORM_PACK8:
-                    write_texel<glm::i8vec4>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RGBA8_USCALED_PACK8:
-                    write_texel<glm::u8vec4>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RGBA8_SSCALED_PACK8:
-                    write_texel<glm::i8vec4>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RGBA8_UINT_PACK8:
-                    write_texel<glm::u8vec4>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RGBA8_SINT_PACK8:
-                    write_texel<glm::i8vec4>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RGBA8_SRGB_PACK8:
-                    write_texel<glm::u8vec4>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-
-                case gli::FORMAT_RGBA8_UNORM_PACK32:
-                    write_texel<glm::u8vec4>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RGBA8_SNORM_PACK32:
-                    write_texel<glm::i8vec4>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RGBA8_USCALED_PACK32:
-                    write_texel<glm::u8vec4>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RGBA8_SSCALED_PACK32:
-                    write_texel<glm::i8vec4>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RGBA8_UINT_PACK32:
-                    write_texel<glm::u8vec4>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RGBA8_SINT_PACK32:
-                    write_texel<glm::i8vec4>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RGBA8_SRGB_PACK32:
-                    write_texel<glm::u8vec4>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-
-                case gli::FORMAT_R16_UNORM_PACK16:
-                    write_texel<glm::u16>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_R16_SNORM_PACK16:
-                    write_texel<glm::i16>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_R16_USCALED_PACK16:
-                    write_texel<glm::u16>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_R16_SSCALED_PACK16:
-                    write_texel<glm::i16>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_R16_UINT_PACK16:
-                    write_texel<glm::u16>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_R16_SINT_PACK16:
-                    write_texel<glm::i16>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_R16_SFLOAT_PACK16:
-                    write_texel<glm::u16>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-
-                case gli::FORMAT_RG16_UNORM_PACK16:
-                    write_texel<glm::u16vec2>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RG16_SNORM_PACK16:
-                    write_texel<glm::i16vec2>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RG16_USCALED_PACK16:
-                    write_texel<glm::u16vec2>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RG16_SSCALED_PACK16:
-                    write_texel<glm::i16vec2>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RG16_UINT_PACK16:
-                    write_texel<glm::u16vec2>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RG16_SINT_PACK16:
-                    write_texel<glm::i16vec2>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RG16_SFLOAT_PACK16:
-                    write_texel<glm::u16vec2>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-
-                case gli::FORMAT_RGB16_UNORM_PACK16:
-                    write_texel<glm::u16vec3>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RGB16_SNORM_PACK16:
-                    write_texel<glm::i16vec3>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RGB16_USCALED_PACK16:
-                    write_texel<glm::u16vec3>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RGB16_SSCALED_PACK16:
-                    write_texel<glm::i16vec3>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RGB16_UINT_PACK16:
-                    write_texel<glm::u16vec3>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RGB16_SINT_PACK16:
-                    write_texel<glm::i16vec3>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RGB16_SFLOAT_PACK16:
-                    write_texel<glm::u16vec3>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-
-                case gli::FORMAT_RGBA16_UNORM_PACK16:
-                    write_texel<glm::u16vec4>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RGBA16_SNORM_PACK16:
-                    write_texel<glm::i16vec4>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RGBA16_USCALED_PACK16:
-                    write_texel<glm::u16vec4>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RGBA16_SSCALED_PACK16:
-                    write_texel<glm::i16vec4>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RGBA16_UINT_PACK16:
-                    write_texel<glm::u16vec4>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RGBA16_SINT_PACK16:
-                    write_texel<glm::i16vec4>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RGBA16_SFLOAT_PACK16:
-                    write_texel<glm::u16vec4>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-
-                case gli::FORMAT_R32_UINT_PACK32:
-                    write_texel<glm::u32>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_R32_SINT_PACK32:
-                    write_texel<glm::i32>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_R32_SFLOAT_PACK32:
-                    write_texel<glm::f32>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-
-                case gli::FORMAT_RG32_UINT_PACK32:
-                    write_texel<glm::u32vec2>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RG32_SINT_PACK32:
-                    write_texel<glm::i32vec2>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RG32_SFLOAT_PACK32:
-                    write_texel<glm::vec2>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-
-                case gli::FORMAT_RGB32_UINT_PACK32:
-                    write_texel<glm::u32vec3>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RGB32_SINT_PACK32:
-                    write_texel<glm::i32vec3>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RGB32_SFLOAT_PACK32:
-                    write_texel<glm::f32vec3>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-
-                case gli::FORMAT_RGBA32_UINT_PACK32:
-                    write_texel<glm::u32vec4>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RGBA32_SINT_PACK32:
-                    write_texel<glm::i32vec4>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RGBA32_SFLOAT_PACK32:
-                    write_texel<glm::vec4>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-
-                case gli::FORMAT_R64_UINT_PACK64:
-                    write_texel<glm::u64>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_R64_SINT_PACK64:
-                    write_texel<glm::i64>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_R64_SFLOAT_PACK64:
-                    write_texel<glm::f64>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-
-                case gli::FORMAT_RG64_UINT_PACK64:
-                    write_texel<glm::u64vec2>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RG64_SINT_PACK64:
-                    write_texel<glm::i64vec2>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RG64_SFLOAT_PACK64:
-                    write_texel<glm::f64vec2>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-
-                case gli::FORMAT_RGB64_UINT_PACK64:
-                    write_texel<glm::u64vec3>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RGB64_SINT_PACK64:
-                    write_texel<glm::i64vec3>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RGB64_SFLOAT_PACK64:
-                    write_texel<glm::f64vec3>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-
-                case gli::FORMAT_RGBA64_UINT_PACK64:
-                    write_texel<glm::u64vec4>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RGBA64_SINT_PACK64:
-                    write_texel<glm::i64vec4>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-                case gli::FORMAT_RGBA64_SFLOAT_PACK64:
-                    write_texel<glm::f64vec4>(buf.ptr, tex, coord, y, x, h_stride, w_stride);
-                    break;
-
-                //TODO:
-                // FORMAT_RG11B10_UFLOAT_PACK32,
-                // FORMAT_RGB9E5_UFLOAT_PACK32,
-                // FORMAT_D16_UNORM_PACK16,
-                // FORMAT_D24_UNORM_PACK32,
-                // FORMAT_D32_SFLOAT_PACK32,
-                // FORMAT_S8_UINT_PACK8,
-                // FORMAT_D16_UNORM_S8_UINT_PACK32,
-                // FORMAT_D24_UNORM_S8_UINT_PACK32,
-                // FORMAT_D32_SFLOAT_S8_UINT_PACK64
-
-                default:
-                    throw std::invalid_argument("Unrecognised Save Format");
-            }
-        }
+    LOGD("Height: " + std::to_string(src.height));
+    LOGD("Width: " + std::to_string(src.width));
+    LOGD("Height Stride: " + std::to_string(src.strides[leading]));
+    LOGD("Width Stride: " + std::to_string(src.strides[leading + 1]));
+    LOGD("Slices: " + std::to_string(src.dims.slices()));
+    return out;
+}
+
+
+/* Copies `src`'s elements from axis `dim` on to `dst` in C order, the last axis must be contiguous */
+void copy_packed(const std::uint8_t *data, const save_layout &src, size_t dim, std::uint8_t *&dst) {
+    const size_t n = size_t(src.shape[dim]);
+    if (dim + 1 == src.shape.size()) {
+        std::memcpy(dst, data, n * src.itemsize);
+        dst += n * src.itemsize;
+        return;
     }
+    for (size_t i = 0; i < n; i++)
+        copy_packed(data + std::ptrdiff_t(i) * src.strides[dim], src, dim + 1, dst);
+}
+
 
-    // Save Texture
-    bool ret = gli::save(tex, filepath);
+/*
+ * Takes a prepared source's layout, repointed at a packed copy of its array, and drops the
+ * array, so a worker can convert the copy without the GIL after the caller has reused or freed
+ * the array. Needs the GIL.
+ */
+save_layout snapshot_source(save_source &src) {
+    save_layout out = std::move(src.layout);
+    const bool contiguous = (src.array.flags() & py::array::c_style) != 0;
+    size_t bytes = out.itemsize;
+    for (py::ssize_t n : out.shape)
+        bytes *= size_t(n);
+    {
+        py::gil_scoped_release release;
+        out.snapshot = pool::acquire(bytes);
+        std::uint8_t *dst = out.snapshot.data();
+        if (contiguous)
+            std::memcpy(dst, out.data, bytes);
+        else
+            copy_packed(out.data, out, 0, dst);
+    }
+    out.data = out.snapshot.data();
+    py::ssize_t stride = py::ssize_t(out.itemsize);
+    for (size_t d = out.shape.size(); d-- > 0;) {
+        out.strides[d] = stride;
+        stride *= out.shape[d];
+    }
+    src.array = py::array();
+    return out;
+}
+
+
+/* Copies a prepared array into a new texture, one layer / face / depth slice per task. No Python calls */
+gli::texture fill_texture(const save_layout &src, size_t num_threads) {
+    const save_shape &dims = src.dims;
+    const size_t height = src.height, width = src.width;
+    gli::extent3d ext(width, height, dims.depth);
+    gli::texture tex = gli::texture(dims.target, src.format, ext, dims.layers, dims.faces, 1);
+
+    parallel_for(dims.slices(), num_threads, [&](size_t s) {
+        const size_t layer = s / (dims.faces * dims.depth);
+        const size_t face = (s / dims.depth) % dims.faces;
+        const size_t z = s % dims.depth;
+
+        // Leading dims are either [L,6] or a single layer / face / depth axis
+        const std::uint8_t *slice_ptr = src.data;
+        if (src.leading == 2)
+            slice_ptr += std::ptrdiff_t(layer) * src.strides[0] + std::ptrdiff_t(face) * src.strides[1];
+        else if (src.leading == 1)
+            slice_ptr += std::ptrdiff_t(s) * src.strides[0];
+
+        auto *dst = static_cast<std::uint8_t *>(tex.data(layer, face, 0)) + z * height * width * src.traits->texel_size;
+        if (src.planar) {
+            interleave_raw(slice_ptr, dst, height * width, src.channels, src.itemsize);
+            if (src.traits->bgr)
+                swap_red_blue(dst, height * width, src.channels, src.itemsize);
+        } else
+            src.traits->save(slice_ptr, src.strides[src.leading], src.strides[src.leading + 1], dst, height, width);
+    });
+    return tex;
+}
+
+
+bool save(std::string filepath, py::object array_arg, gli::format format, const std::string &layout, py::object target, int zstd_level) {
+    const save_source src = prepare_save(array_arg, format, layout, target);
+
+    // Populate and save the texture
+    py::gil_scoped_release release;
+    gli::texture tex = fill_texture(src.layout, 0);
+    bool ret = save_texture(tex, filepath, zstd_level, 0);
       
     return ret;
 }
 
 
+/* Returned by save_async(), result() waits for the write with the GIL released */
+class save_future {
+public:
+    explicit save_future(std::shared_ptr<writeback::job> state) : state_(std::move(state)) {}
+
+    bool done() const { return state_->done(); }
+
+    /* True once written, raises the write's error, or TimeoutError if still running after `timeout` seconds */
+    bool result(py::object timeout) const {
+        const bool wait_forever = timeout.is_none();
+        const double seconds = wait_forever ? 0.0 : timeout.cast<double>();
+        bool finished = true;
+        {
+            py::gil_scoped_release release;
+            if (wait_forever)
+                state_->wait();
+            else
+                finished = state_->wait_for(seconds);
+        }
+        if (!finished) {
+            PyErr_SetString(PyExc_TimeoutError, "save_async() write still running");
+            throw py::error_already_set();
+        }
+        if (std::exception_ptr error = state_->error())
+            std::rethrow_exception(error);
+        return true;
+    }
+
+private:
+    std::shared_ptr<writeback::job> state_;
+};
+
+
+/* An array save_async(copy=False) reads from its worker, kept alive until the write is done */
+struct async_source {
+    std::shared_ptr<writeback::job> state;
+    std::shared_ptr<save_source> source;
+};
+
+std::mutex async_sources_mutex;
+
+
+/* Never destroyed, as it can still hold arrays when the interpreter shuts down */
+std::vector<async_source> &async_sources() {
+    static auto *sources = new std::vector<async_source>();
+    return *sources;
+}
+
+
+/* Drops the arrays of finished copy=False writes, needs the GIL */
+void release_finished_sources() {
+    std::vector<async_source> finished;
+    {
+        std::lock_guard<std::mutex> lock(async_sources_mutex);
+        auto &sources = async_sources();
+        auto done = std::partition(sources.begin(), sources.end(), [](const async_source &s) { return !s.state->done(); });
+        finished.assign(std::make_move_iterator(done), std::make_move_iterator(sources.end()));
+        sources.erase(done, sources.end());
+    }
+}
+
+
+/*
+ * save() on the background writer queue. With copy=True the array's bytes are copied before
+ * returning, so the caller may reuse it straight away, and the worker converts that copy into
+ * the texture. With copy=False the worker reads the array itself, saving the copy, and the
+ * caller must leave it unchanged until the future is done. Workers fill textures on their own
+ * thread, the pool already runs one write per worker. Blocks only while the queue is full.
+ */
+std::shared_ptr<save_future> save_async(std::string filepath, py::object array_arg, gli::format format, const std::string &layout,
+                                        py::object target, int zstd_level, bool copy) {
+    release_finished_sources();
+    auto src = std::make_shared<save_source>(prepare_save(array_arg, format, layout, target));
+    std::shared_ptr<writeback::job> state;
+    if (copy) {
+        // The worker owns only the copy, the array is dropped here with the GIL held
+        auto snapshot = std::make_shared<save_layout>(snapshot_source(*src));
+        src.reset();
+        py::gil_scoped_release release;
+        state = writeback::writer_pool::global().submit([snapshot, filepath, zstd_level]() {
+            const gli::texture tex = fill_texture(*snapshot, 1);
+            if (!save_texture(tex, filepath, zstd_level, 1))
+                throw std::runtime_error("Failed to save: " + filepath);
+        });
+    } else {
+        const save_layout *view = &src->layout;
+        {
+            py::gil_scoped_release release;
+            state = writeback::writer_pool::global().submit([view, filepath, zstd_level]() {
+                const gli::texture tex = fill_texture(*view, 1);
+                if (!save_texture(tex, filepath, zstd_level, 1))
+                    throw std::runtime_error("Failed to save: " + filepath);
+            });
+        }
+        std::lock_guard<std::mutex> lock(async_sources_mutex);
+        async_sources().push_back({state, std::move(src)});
+    }
+    return std::make_shared<save_future>(state);
+}
+
+
+/* Waits for every save_async() write so far */
+void flush() {
+    {
+        py::gil_scoped_release release;
+        writeback::writer_pool::global().flush();
+    }
+    release_finished_sources();
+}
+
+
+/* Queue depth, outcome counts and submit-to-written latency (seconds) of save_async() */
+py::dict save_async_stats() {
+    const writeback::queue_stats stats = writeback::writer_pool::global().stats();
+    py::dict out;
+    out["queued"] = stats.queued;
+    out["active"] = stats.active;
+    out["completed"] = stats.completed;
+    out["failed"] = stats.failed;
+    out["workers"] = stats.workers;
+    out["max_queued"] = stats.max_queued;
+    out["last_latency"] = stats.last_latency;
+    out["mean_latency"] = stats.mean_latency;
+    out["max_latency"] = stats.max_latency;
+    return out;
+}
+
+
+void configure_save_async(py::object num_workers, py::object max_queued) {
+    const writeback::queue_stats current = writeback::writer_pool::global().stats();
+    const size_t workers = num_workers.is_none() ? current.workers : num_workers.cast<size_t>();
+    const size_t queued = max_queued.is_none() ? current.max_queued : max_queued.cast<size_t>();
+    if (workers == 0 || queued == 0)
+        throw std::invalid_argument("num_workers and max_queued must be at least 1");
+    py::gil_scoped_release release;
+    writeback::writer_pool::global().configure(workers, queued);
+}
+
+
+/*
+ * Packs [H,W,C] images into one 2D texture saved to `filepath`, returning an [N,4] float32
+ * array of (u0, v0, u1, v1) per image in input order. Each image is surrounded by `padding`
+ * texels repeating its edges so bilinear filtering and mips stay inside it.
+ */
+py::array pack_atlas(const std::string &filepath, const std::vector<py::array> &arrays, gli::format format, size_t max_size,
+                     size_t padding, bool mips, int zstd_level, size_t num_threads) {
+    const format_traits *traits = find_format_traits(format);
+    if (!traits)
+        throw std::invalid_argument("Unrecognised Save Format");
+    if (arrays.empty())
+        throw std::invalid_argument("No images to pack");
+    if (max_size < 4 || max_size % 4 != 0)
+        throw std::invalid_argument("max_size must be a positive multiple of 4");
+
+    // Each image only needs its texels' channels to be adjacent, as in save()
+    std::vector<py::array> images;
+    std::vector<py::buffer_info> bufs;
+    std::vector<atlas::rect> sizes;
+    for (const py::array &arg : arrays) {
+        py::array array = arg;
+        if (array.ndim() != 3)
+            throw std::invalid_argument("pack_atlas() takes [H,W,C] arrays");
+        if (array.strides(2) != array.itemsize())
+            array = py::array::ensure(array, py::array::c_style);
+        bufs.push_back(array.request());
+        images.push_back(array);
+        const py::buffer_info &buf = bufs.back();
+        check_save_dtype(size_t(buf.shape[2]), array.dtype(), *traits);
+        if (buf.shape[0] == 0 || buf.shape[1] == 0)
+            throw std::invalid_argument("Images must not be empty");
+        atlas::rect r;
+        r.width = size_t(buf.shape[1]) + 2 * padding;
+        r.height = size_t(buf.shape[0]) + 2 * padding;
+        sizes.push_back(r);
+    }
+
+    std::vector<atlas::rect> placed;
+    size_t width = 0, height = 0;
+    if (!atlas::pack(sizes, max_size, placed, width, height))
+        throw std::invalid_argument("Images don't fit in a " + std::to_string(max_size) + "x" + std::to_string(max_size) + " atlas");
+    for (size_t i = 0; i < placed.size(); i++) {
+        placed[i].x += padding;
+        placed[i].y += padding;
+        placed[i].width = size_t(bufs[i].shape[1]);
+        placed[i].height = size_t(bufs[i].shape[0]);
+    }
+
+    const size_t levels = mips ? atlas::mip_levels(width, height) : 1;
+    gli::texture tex(gli::TARGET_2D, format, gli::extent3d(width, height, 1), 1, 1, levels);
+    {
+        // Padded rectangles don't overlap, so every image is blitted and bled by its own task
+        py::gil_scoped_release release;
+        auto *base = static_cast<std::uint8_t *>(tex.data(0, 0, 0));
+        std::memset(base, 0, width * height * traits->texel_size);
+        const size_t row_bytes = width * traits->texel_size;
+        parallel_for(placed.size(), num_threads, [&](size_t i) {
+            const atlas::rect &r = placed[i];
+            const py::buffer_info &buf = bufs[i];
+            for (size_t y = 0; y < r.height; y++)
+                traits->save(static_cast<const std::uint8_t *>(buf.ptr) + y * buf.strides[0], buf.strides[0], buf.strides[1],
+                             base + (r.y + y) * row_bytes + r.x * traits->texel_size, 1, r.width);
+            atlas::bleed_edges(base, width, traits->texel_size, r, padding);
+        });
+        if (mips)
+            atlas::generate_mips(tex, *traits, num_threads);
+        if (!save_texture(tex, filepath, zstd_level, 1))
+            throw std::runtime_error("Failed to save atlas: " + filepath);
+    }
+
+    py::array_t<float> uvs(std::vector<size_t>{placed.size(), 4});
+    float *out = uvs.mutable_data();
+    for (const atlas::rect &r : placed) {
+        *out++ = float(r.x) / float(width);
+        *out++ = float(r.y) / float(height);
+        *out++ = float(r.x + r.width) / float(width);
+        *out++ = float(r.y + r.height) / float(height);
+    }
+    return uvs;
+}
+
+
+/*
+ * Overwrites `region` (x, y, width, height in texels, default the whole level) of one image
+ * of an existing DDS file in place. The array is [H,W,C] texels in the file's format, or for
+ * block compressed formats [rows, columns, block bytes] of encoded blocks, in which case the
+ * region has to line up with blocks. Returns the number of texel bytes written.
+ */
+size_t update(const std::string &filepath, py::array array, size_t level, size_t layer, size_t face, py::object region_arg) {
+    const dds::file_layout file(filepath);
+    const texture_header &header = file.header();
+    if (level >= header.levels || layer >= header.layers || face >= header.faces)
+        throw std::invalid_argument("level / layer / face out of range for " + filepath);
+
+    const size_t level_width = file.level_width(level);
+    const size_t level_height = file.level_height(level);
+    dds::region area;
+    if (region_arg.is_none()) {
+        area.width = level_width;
+        area.height = level_height;
+    } else {
+        const auto values = region_arg.cast<std::vector<size_t>>();
+        if (values.size() != 4)
+            throw std::invalid_argument("region is (x, y, width, height)");
+        area.x = values[0];
+        area.y = values[1];
+        area.width = values[2];
+        area.height = values[3];
+    }
+    if (area.width == 0 || area.height == 0 || area.x + area.width > level_width || area.y + area.height > level_height)
+        throw std::invalid_argument("Region lies outside the " + std::to_string(level_width) + "x" + std::to_string(level_height) + " level");
+
+    // Compressed images are edited a whole block at a time, edge blocks may be partly outside the level
+    const size_t bw = file.block_width(), bh = file.block_height();
+    const bool compressed = gli::is_compressed(header.format);
+    if (compressed) {
+        auto aligned = [](size_t start, size_t size, size_t block, size_t limit) {
+            return start % block == 0 && (size % block == 0 || start + size == limit);
+        };
+        if (!aligned(area.x, area.width, bw, level_width) || !aligned(area.y, area.height, bh, level_height))
+            throw std::invalid_argument("Region must line up with the format's " + std::to_string(bw) + "x" + std::to_string(bh) + " blocks");
+    }
+
+    const size_t rows = (area.height + bh - 1) / bh;
+    const size_t columns = (area.width + bw - 1) / bw;
+    const format_traits *traits = nullptr;
+    if (array.ndim() != 3 || size_t(array.shape(0)) != rows || size_t(array.shape(1)) != columns)
+        throw std::invalid_argument("Array shape doesn't match the region, expected [" + std::to_string(rows) + ", " + std::to_string(columns) + ", ...]");
+    if (compressed) {
+        if (size_t(array.shape(2) * array.itemsize()) != file.block_size())
+            throw std::invalid_argument("Array must hold " + std::to_string(file.block_size()) + " bytes per block");
+    } else {
+        traits = find_format_traits(header.format);
+        if (!traits)
+            throw std::invalid_argument("Unrecognised format in " + filepath);
+        check_save_dtype(size_t(array.shape(2)), array.dtype(), *traits);
+    }
+
+    // Packed rows go to the file as they are, BGR texels are reordered into a copy first
+    array = py::array::ensure(array, py::array::c_style);
+    if (!array)
+        throw std::runtime_error("Array could not be made contiguous");
+    const auto *src = static_cast<const std::uint8_t *>(array.data());
+
+    py::gil_scoped_release release;
+    pool::buffer reordered;
+    if (traits && traits->bgr) {
+        reordered = pool::acquire(rows * columns * traits->texel_size);
+        traits->save(src, std::ptrdiff_t(columns * traits->texel_size), std::ptrdiff_t(traits->texel_size), reordered.data(), rows, columns);
+        src = reordered.data();
+    }
+    return dds::write_region(filepath, file, layer, face, level, area, src, columns * file.block_size());
+}
+
+
+/* Checks one [rows, W, C] band of save_tiled() input against the format, packing it if its texels aren't */
+py::buffer_info tiled_band(py::array &band, const format_traits &traits, size_t rows, size_t width) {
+    if (band.ndim() != 3 || size_t(band.shape(0)) != rows || size_t(band.shape(1)) != width)
+        throw std::invalid_argument("Source rows must be [" + std::to_string(rows) + ", " + std::to_string(width) + ", C]");
+    check_save_dtype(size_t(band.shape(2)), band.dtype(), traits);
+    if (band.strides(2) != band.itemsize()) {
+        band = py::array::ensure(band, py::array::c_style);
+        if (!band)
+            throw std::runtime_error("Array could not be made contiguous");
+    }
+    return band.request();
+}
+
+
+/*
+ * Writes a virtual texture page file (see tiles.hpp) from an [H,W,C] array, e.g. a memmap,
+ * or from a callable source(y0, y1) returning rows y0 .. y1-1, which needs shape=(H, W).
+ * Callables are asked for one strip of `tile` rows at a time. Returns the number of tiles.
+ */
+size_t save_tiled(const std::string &filepath, py::object source, gli::format format, size_t tile, size_t border,
+                  py::object shape, size_t levels, int zstd_level, size_t num_threads) {
+    const format_traits *traits = find_format_traits(format);
+    if (!traits)
+        throw std::invalid_argument("Unrecognised Save Format");
+    if (tile == 0)
+        throw std::invalid_argument("tile must be at least 1");
+
+    py::array array;
+    size_t height = 0, width = 0;
+    if (py::isinstance<py::array>(source)) {
+        array = source.cast<py::array>();
+        if (array.ndim() != 3)
+            throw std::invalid_argument("save_tiled() takes an [H,W,C] array");
+        height = size_t(array.shape(0));
+        width = size_t(array.shape(1));
+    } else if (PyCallable_Check(source.ptr())) {
+        if (shape.is_none())
+            throw std::invalid_argument("A callable source needs shape=(height, width)");
+        const auto hw = shape.cast<std::vector<size_t>>();
+        if (hw.size() != 2)
+            throw std::invalid_argument("shape is (height, width)");
+        height = hw[0];
+        width = hw[1];
+    } else {
+        throw std::invalid_argument("save_tiled() takes an array or a callable returning rows");
+    }
+    if (height == 0 || width == 0)
+        throw std::invalid_argument("Image is empty");
+
+    tiles::options opts;
+    opts.tile = tile;
+    opts.border = border;
+    opts.levels = levels;
+    opts.zstd_level = zstd_level;
+    opts.num_threads = num_threads;
+
+    tiles::header info = {};
+    std::memcpy(info.magic, tiles::MAGIC, sizeof(info.magic));
+    info.version = tiles::VERSION;
+    info.format = std::uint32_t(format);
+    info.width = std::uint32_t(width);
+    info.height = std::uint32_t(height);
+    info.tile = std::uint32_t(tile);
+    info.border = std::uint32_t(border);
+    info.levels = std::uint32_t(tiles::pyramid_levels(width, height, opts));
+    info.compression = zstd_level > 0 ? 1 : 0;
+
+    tiles::page_writer writer(filepath, info);
+    tiles::pyramid builder(*traits, width, height, opts, writer);
+    if (array) {
+        // Arrays and memmaps are read a row at a time, only the rows in flight need to be resident
+        py::buffer_info buf = tiled_band(array, *traits, height, width);
+        py::gil_scoped_release release;
+        builder.push_rows(buf.ptr, buf.strides[0], buf.strides[1], height);
+    } else {
+        for (size_t y = 0; y < height; y += tile) {
+            const size_t rows = std::min(tile, height - y);
+            py::array band = py::array::ensure(source(y, y + rows));
+            if (!band)
+                throw std::invalid_argument("Source must return an array");
+            py::buffer_info buf = tiled_band(band, *traits, rows, width);
+            py::gil_scoped_release release;
+            builder.push_rows(buf.ptr, buf.strides[0], buf.strides[1], rows);
+        }
+    }
+
+    py::gil_scoped_release release;
+    builder.finish();
+    writer.finish();
+    return writer.tile_count();
+}
+
+
+/* Reuse counters of the buffer pool behind file reads and conversion scratch space */
+py::dict buffer_pool_stats() {
+    const pool::pool_stats stats = pool::buffer_pool::global().stats();
+    py::dict out;
+    out["cached_bytes"] = stats.cached_bytes;
+    out["cached_buffers"] = stats.cached_buffers;
+    out["hits"] = stats.hits;
+    out["misses"] = stats.misses;
+    out["max_bytes"] = stats.max_bytes;
+    out["huge_pages"] = stats.huge_pages;
+    return out;
+}
+
+
+/* Arguments left as None keep their current setting */
+void configure_buffer_pool(py::object max_bytes, py::object huge_pages) {
+    pool::buffer_pool &global = pool::buffer_pool::global();
+    const pool::pool_stats current = global.stats();
+    global.configure(max_bytes.is_none() ? current.max_bytes : max_bytes.cast<size_t>(),
+                     huge_pages.is_none() ? current.huge_pages : huge_pages.cast<bool>());
+}
+
+
 void add_format_enum(py::module &m) {
     py::enum_<gli::format>(m, "Format")
         .value("UNDEFINED", gli::FORMAT_UNDEFINED)
@@ -1056,11 +1625,103 @@ void add_format_enum(py::module &m) {
 }
 
 
-PYBIND11_MODULE(_core, m) {
+void add_target_enum(py::module &m) {
+    py::enum_<gli::target>(m, "Target")
+        .value("TARGET_1D", gli::TARGET_1D)
+        .value("TARGET_1D_ARRAY", gli::TARGET_1D_ARRAY)
+        .value("TARGET_2D", gli::TARGET_2D)
+        .value("TARGET_2D_ARRAY", gli::TARGET_2D_ARRAY)
+        .value("TARGET_3D", gli::TARGET_3D)
+        .value("TARGET_RECT", gli::TARGET_RECT)
+        .value("TARGET_RECT_ARRAY", gli::TARGET_RECT_ARRAY)
+        .value("TARGET_CUBE", gli::TARGET_CUBE)
+        .value("TARGET_CUBE_ARRAY", gli::TARGET_CUBE_ARRAY)
+        .export_values();
+}
+
+
+/*
+ * Declared safe without the GIL for free-threaded CPython. Module state is either immutable
+ * after import (the Format / Target enums, format_traits tables), atomic (shared memory name
+ * counter and reference counts) or behind its own mutex (the buffer pool, the save_async()
+ * queue and its list of borrowed arrays), and every call otherwise works on its own texture
+ * and buffers.
+ */
+PYBIND11_MODULE(_core, m, py::mod_gil_not_used()) {
     m.doc() = "Wrapper for reading gli textures";
     add_format_enum(m);
-    m.def("load", &load, "Load texture file and return as NumPy array");
-    m.def("save", &save, "Save texture file and return as NumPy array");
+    add_target_enum(m);
+    py::class_<shared_array, std::shared_ptr<shared_array>>(m, "SharedArray", "Handle of a shared memory output, picklable and reattachable in other processes")
+        .def("array", [](py::object self) { return self.cast<const shared_array &>().array(self); }, "NumPy view of the shared memory")
+        .def_property_readonly("name", [](const shared_array &a) { return a.segment->name(); })
+        .def_property_readonly("nbytes", [](const shared_array &a) { return a.segment->size(); })
+        .def_property_readonly("shape", [](const shared_array &a) { return a.shape; })
+        .def(py::pickle(
+            [](const shared_array &a) {
+                a.segment->add_ref();
+                return py::make_tuple(a.segment->name(), a.segment->size(), a.dtype, a.shape);
+            },
+            [](py::tuple state) {
+                return std::make_shared<shared_array>(shared_array{
+                    shm::segment::attach(state[0].cast<std::string>(), state[1].cast<size_t>(), true),
+                    state[2].cast<std::string>(), state[3].cast<std::vector<size_t>>()});
+            }));
+    m.def("load", &load, "Load texture file and return as NumPy array, with the SharedArray (shared=True) and statistics dict (stats=True) appended as a tuple, or as a DLPack capsule (as_dlpack=True)",
+          py::arg("filepath"), py::arg("layout") = "HWC", py::arg("shared") = false, py::arg("size") = py::none(),
+          py::arg("filter") = "box", py::arg("stats") = false, py::arg("as_dlpack") = false);
+    m.def("compare", &compare_images, "Per-channel MSE / PSNR / max abs error / SSIM between two images, each a file path or an array",
+          py::arg("a"), py::arg("b"), py::arg("metrics") = std::vector<std::string>{"mse", "psnr", "maxabs", "ssim"},
+          py::arg("data_range") = py::none(), py::arg("num_threads") = 0);
+    m.def("stats_of", &stats_of, "Per-channel min / max / mean / std / NaN / Inf counts and histograms of a texture file",
+          py::arg("filepath"));
+    m.def("load_batch", &load_batch, "Load same-shaped texture files into one [N,H,W,C] (or [N,C,H,W]) NumPy array",
+          py::arg("paths"), py::arg("out") = py::none(), py::arg("layout") = "NHWC", py::arg("num_threads") = 0,
+          py::arg("shared") = false);
+    py::class_<texture_iterator>(m, "TextureIterator", "Images decoded ahead on native threads, created by iterate()")
+        .def("__iter__", [](py::object self) { return self; })
+        .def("__next__", &texture_iterator::next)
+        .def("__len__", &texture_iterator::size)
+        .def("close", &texture_iterator::close, "Stop decoding ahead and drop the images not yet taken");
+    m.def("iterate", &iterate, "Iterate over texture files decoded ahead on native threads, holding at most `prefetch` images",
+          py::arg("paths"), py::arg("prefetch") = 8, py::arg("num_threads") = 0, py::arg("ordered") = true, py::arg("errors") = "raise",
+          py::arg("layout") = "HWC", py::arg("size") = py::none(), py::arg("filter") = "box");
+    m.def("write_pack", &write_pack, "Pack texture files into one indexed archive for random access through Pack",
+          py::arg("filepath"), py::arg("paths"), py::arg("names") = py::none(), py::arg("append") = false, py::arg("num_threads") = 0);
+    py::class_<pack::reader>(m, "Pack", "Texture pack opened with mmap, indexed by name")
+        .def(py::init<const std::string &>(), py::arg("filepath"))
+        .def("__len__", &pack::reader::size)
+        .def("__contains__", [](const pack::reader &reader, const std::string &key) { return reader.find(key) != nullptr; })
+        .def("__getitem__", [](py::object self, const std::string &key) { return pack_load(self, key, "HWC"); })
+        .def("keys", &pack::reader::keys, "Names of the packed textures, sorted")
+        .def("load", &pack_load, "Load a packed texture as a NumPy array, a read-only view where possible",
+             py::arg("key"), py::arg("layout") = "HWC");
+    m.def("buffer_pool_stats", &buffer_pool_stats, "Cached bytes / buffers and hit / miss counts of the internal buffer pool");
+    m.def("configure_buffer_pool", &configure_buffer_pool, "Set how many bytes the buffer pool may keep cached (0 disables it) and whether it uses huge pages",
+          py::arg("max_bytes") = py::none(), py::arg("huge_pages") = py::none());
+    m.def("clear_buffer_pool", []() { pool::buffer_pool::global().clear(); }, "Free every buffer the pool is holding on to");
+    m.def("save", &save, "Save a NumPy array or DLPack tensor to a texture file: [H,W,C] (or [C,H,W]) images, [N,H,W,C] texture arrays, cubemaps (N=6) and volumes (N=depth), [L,6,H,W,C] cube arrays. Returns True once written",
+          py::arg("filepath"), py::arg("array"), py::arg("format"), py::arg("layout") = "HWC", py::arg("target") = py::none(),
+          py::arg("zstd_level") = 3);
+    m.def("update", &update, "Overwrite a region of one level / layer / face of an existing DDS file in place, writing only the rows it covers",
+          py::arg("filepath"), py::arg("array"), py::arg("level") = 0, py::arg("layer") = 0, py::arg("face") = 0,
+          py::arg("region") = py::none());
+    py::class_<save_future, std::shared_ptr<save_future>>(m, "SaveFuture", "Pending save_async() write")
+        .def("done", &save_future::done, "Whether the write has finished, successfully or not")
+        .def("result", &save_future::result, "Wait for the write, True once written, raises its error",
+             py::arg("timeout") = py::none());
+    m.def("save_async", &save_async, "Queue a save() on background writer threads and return a SaveFuture, snapshotting the array unless copy=False",
+          py::arg("filepath"), py::arg("array"), py::arg("format"), py::arg("layout") = "HWC", py::arg("target") = py::none(),
+          py::arg("zstd_level") = 3, py::arg("copy") = true);
+    m.def("flush", &flush, "Wait for every queued save_async() write");
+    m.def("save_async_stats", &save_async_stats, "Queue depth, completed / failed counts and write latency of save_async()");
+    m.def("configure_save_async", &configure_save_async, "Set the number of writer threads and how many writes may wait before save_async() blocks",
+          py::arg("num_workers") = py::none(), py::arg("max_queued") = py::none());
+    m.def("save_tiled", &save_tiled, "Write a mip pyramid of bordered tiles to a page file from an array, memmap or row callback, out of core",
+          py::arg("filepath"), py::arg("source"), py::arg("format"), py::arg("tile") = 128, py::arg("border") = 4,
+          py::arg("shape") = py::none(), py::arg("levels") = 0, py::arg("zstd_level") = 3, py::arg("num_threads") = 0);
+    m.def("pack_atlas", &pack_atlas, "Pack [H,W,C] arrays into one texture file with edge-bled padding and return their [N,4] UV rectangles",
+          py::arg("filepath"), py::arg("arrays"), py::arg("format"), py::arg("max_size") = 4096, py::arg("padding") = 2,
+          py::arg("mips") = false, py::arg("zstd_level") = 3, py::arg("num_threads") = 0);
 #ifdef VERSION_INFO
     m.attr("__version__") = MACRO_STRINGIFY(VERSION_INFO);
 #else
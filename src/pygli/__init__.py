@@ -1,3 +1,8 @@
-from ._core import __doc__, __version__, load, save, Format
+import atexit
 
-__all__ = ["__doc__", "__version__", "load", "save", "Format"]
\ No newline at end of file
+from ._core import __doc__, __version__, load, load_batch, iterate, stats_of, compare, save, save_async, flush, save_async_stats, configure_save_async, save_tiled, update, pack_atlas, write_pack, buffer_pool_stats, configure_buffer_pool, clear_buffer_pool, Pack, SharedArray, TextureIterator, SaveFuture, Format, Target
+
+__all__ = ["__doc__", "__version__", "load", "load_batch", "iterate", "stats_of", "compare", "save", "save_async", "flush", "save_async_stats", "configure_save_async", "save_tiled", "update", "pack_atlas", "write_pack", "buffer_pool_stats", "configure_buffer_pool", "clear_buffer_pool", "Pack", "SharedArray", "TextureIterator", "SaveFuture", "Format", "Target"]
+
+# Queued save_async() writes land before the interpreter exits
+atexit.register(flush)
@@ -0,0 +1,218 @@
+#pragma once
+
+#include <cmath>
+#include <limits>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+
+#include <gli/gli.hpp>
+
+#include "parallel.hpp"
+
+
+/*
+ * Separable image resampling used by load(size=...). Weights are computed once per axis,
+ * then a horizontal pass filters every source row into a float (or double) buffer and a
+ * vertical pass blends whole rows of that buffer, which are contiguous so the inner loop
+ * vectorises. Both passes are split across threads by rows.
+ */
+enum class resize_filter {
+    nearest,
+    box,        // area average when shrinking
+    bilinear,   // triangle / tent
+    lanczos3,
+};
+
+
+inline resize_filter parse_resize_filter(const std::string &name) {
+    if (name == "nearest")
+        return resize_filter::nearest;
+    if (name == "box")
+        return resize_filter::box;
+    if (name == "bilinear")
+        return resize_filter::bilinear;
+    if (name == "lanczos3")
+        return resize_filter::lanczos3;
+    throw std::invalid_argument("Unrecognised Filter: " + name);
+}
+
+
+/* Smallest mip level that still covers width x height, reading anything smaller would upsample */
+inline size_t pick_level(const gli::extent3d &base, size_t levels, size_t width, size_t height) {
+    size_t level = 0;
+    while (level + 1 < levels
+           && std::max<size_t>(size_t(base.x) >> (level + 1), 1) >= width
+           && std::max<size_t>(size_t(base.y) >> (level + 1), 1) >= height)
+        level++;
+    return level;
+}
+
+
+inline gli::extent3d level_extent(const gli::extent3d &base, size_t level) {
+    return gli::extent3d(std::max(base.x >> level, 1), std::max(base.y >> level, 1), std::max(base.z >> level, 1));
+}
+
+
+namespace detail {
+
+/* Source taps of every output sample along one axis. Taps that fall off the edge are folded onto the edge texel */
+struct axis_weights {
+    size_t taps = 0;                    // stride of `weights`
+    std::vector<std::int32_t> first;    // first source index per output sample
+    std::vector<std::int32_t> count;    // taps used per output sample
+    std::vector<float> weights;         // normalised, `taps` per output sample
+};
+
+
+inline double filter_radius(resize_filter filter) {
+    switch (filter) {
+        case resize_filter::box: return 0.5;
+        case resize_filter::bilinear: return 1.0;
+        case resize_filter::lanczos3: return 3.0;
+        default: return 0.5;
+    }
+}
+
+
+inline double filter_weight(resize_filter filter, double x) {
+    x = std::abs(x);
+    switch (filter) {
+        case resize_filter::box:
+            return x <= 0.5 ? 1.0 : 0.0;
+        case resize_filter::bilinear:
+            return std::max(0.0, 1.0 - x);
+        case resize_filter::lanczos3: {
+            if (x >= 3.0)
+                return 0.0;
+            if (x < 1e-8)
+                return 1.0;
+            const double pi_x = 3.14159265358979323846 * x;
+            return 3.0 * std::sin(pi_x) * std::sin(pi_x / 3.0) / (pi_x * pi_x);
+        }
+        default:
+            return 0.0;
+    }
+}
+
+
+inline axis_weights make_axis_weights(size_t src, size_t dst, resize_filter filter) {
+    axis_weights out;
+    out.first.resize(dst);
+    out.count.resize(dst);
+    const double scale = double(dst) / double(src);
+
+    if (filter == resize_filter::nearest) {
+        out.taps = 1;
+        out.weights.assign(dst, 1.0f);
+        for (size_t i = 0; i < dst; i++) {
+            out.first[i] = std::int32_t(std::min(size_t((i + 0.5) / scale), src - 1));
+            out.count[i] = 1;
+        }
+        return out;
+    }
+
+    // Shrinking widens the kernel to cover every source texel under the output texel
+    const double stretch = std::min(scale, 1.0);
+    const double support = filter_radius(filter) / stretch;
+    out.taps = std::min(size_t(std::ceil(support * 2)) + 1, src);
+    out.weights.assign(dst * out.taps, 0.0f);
+
+    std::vector<double> window;
+    for (size_t i = 0; i < dst; i++) {
+        const double center = (i + 0.5) / scale - 0.5;
+        const std::int64_t lo = std::int64_t(std::floor(center - support));
+        const std::int64_t hi = std::int64_t(std::ceil(center + support));
+        const std::int64_t begin = std::max<std::int64_t>(lo, 0);
+        const std::int64_t end = std::min<std::int64_t>(hi, std::int64_t(src) - 1);
+
+        window.assign(size_t(end - begin + 1), 0.0);
+        double total = 0.0;
+        for (std::int64_t j = lo; j <= hi; j++) {
+            const double w = filter_weight(filter, (double(j) - center) * stretch);
+            window[size_t(std::clamp<std::int64_t>(j, begin, end) - begin)] += w;
+            total += w;
+        }
+
+        // Trim zero weights so the stored window fits in `taps`
+        size_t a = 0, b = window.size();
+        while (a + 1 < b && window[a] == 0.0)
+            a++;
+        while (b - 1 > a && window[b - 1] == 0.0)
+            b--;
+        b = std::min(b, a + out.taps);
+
+        out.first[i] = std::int32_t(begin + std::int64_t(a));
+        out.count[i] = std::int32_t(b - a);
+        for (size_t t = a; t < b; t++)
+            out.weights[i * out.taps + (t - a)] = float(total != 0.0 ? window[t] / total : (t == a));
+    }
+    return out;
+}
+
+
+template <typename T, typename Acc>
+inline T store_as(Acc v) {
+    if constexpr (std::is_floating_point<T>::value) {
+        return T(v);
+    } else {
+        const Acc lo = Acc(std::numeric_limits<T>::lowest());
+        const Acc hi = Acc(std::numeric_limits<T>::max());
+        return T(std::clamp(std::round(v), lo, hi));
+    }
+}
+
+} // namespace detail
+
+
+/* Resamples an interleaved [src_h, src_w, C] image into [dst_h, dst_w, C] */
+template <typename T, size_t C>
+void resize_texels(const void *src_ptr, size_t src_w, size_t src_h, void *dst_ptr, size_t dst_w, size_t dst_h,
+                   resize_filter filter, size_t num_threads) {
+    // 32 / 64 bit integers and doubles need the wider accumulator to stay exact
+    using acc_t = std::conditional_t<(sizeof(T) >= 4 && !std::is_same<T, float>::value), double, float>;
+    const T *src = static_cast<const T *>(src_ptr);
+    T *dst = static_cast<T *>(dst_ptr);
+
+    const detail::axis_weights xw = detail::make_axis_weights(src_w, dst_w, filter);
+    const detail::axis_weights yw = detail::make_axis_weights(src_h, dst_h, filter);
+    const size_t row = dst_w * C;
+
+    // Only the source rows some output row reads go through the horizontal pass
+    const size_t row_begin = size_t(yw.first.front());
+    const size_t row_end = size_t(yw.first.back() + yw.count.back());
+    std::vector<acc_t> tmp((row_end - row_begin) * row);
+
+    parallel_for(row_end - row_begin, num_threads, [&](size_t r) {
+        const T *in = src + (row_begin + r) * src_w * C;
+        acc_t *out = tmp.data() + r * row;
+        for (size_t x = 0; x < dst_w; x++) {
+            const T *taps = in + size_t(xw.first[x]) * C;
+            const float *w = xw.weights.data() + x * xw.taps;
+            acc_t acc[C] = {};
+            for (std::int32_t t = 0; t < xw.count[x]; t++)
+                for (size_t c = 0; c < C; c++)
+                    acc[c] += acc_t(w[t]) * acc_t(taps[t * C + c]);
+            for (size_t c = 0; c < C; c++)
+                out[x * C + c] = acc[c];
+        }
+    });
+
+    parallel_for(dst_h, num_threads, [&](size_t y) {
+        std::vector<acc_t> acc(row, acc_t(0));
+        const float *w = yw.weights.data() + y * yw.taps;
+        for (std::int32_t t = 0; t < yw.count[y]; t++) {
+            const acc_t *in = tmp.data() + (size_t(yw.first[y]) + t - row_begin) * row;
+            const acc_t weight = acc_t(w[t]);
+            for (size_t i = 0; i < row; i++)
+                acc[i] += weight * in[i];
+        }
+        T *out = dst + y * row;
+        for (size_t i = 0; i < row; i++)
+            out[i] = detail::store_as<T>(acc[i]);
+    });
+}
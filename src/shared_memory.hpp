@@ -0,0 +1,121 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+/*
+ * Named POSIX shared memory segments for outputs that are handed to other processes.
+ * The segment starts with a cross-process reference count, every attached segment object
+ * holds one reference and the last one to detach unlinks the name. A reference can also
+ * be "in flight" (taken by pickling a handle, given back by the attach that unpickles it)
+ * so a worker may drop its handle before the receiving process has attached.
+ */
+namespace shm {
+
+struct segment_header {
+    std::atomic<std::uint32_t> refs;
+    std::uint32_t reserved[15];
+};
+
+static_assert(sizeof(segment_header) == 64, "shared memory header must keep the data 64-byte aligned");
+static_assert(std::atomic<std::uint32_t>::is_always_lock_free, "cross-process reference count must be lock free");
+
+
+class segment {
+public:
+    /* A new segment of `bytes` zeroed bytes, holding the only reference */
+    static std::shared_ptr<segment> create(size_t bytes) {
+#ifdef _WIN32
+        (void)bytes;
+        throw std::runtime_error("Shared memory outputs need POSIX shared memory");
+#else
+        static std::atomic<std::uint64_t> counter(0);
+        const std::string name = "/pygli_" + std::to_string(::getpid()) + "_" + std::to_string(counter++);
+        const int fd = ::shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0)
+            throw std::runtime_error("Failed to create shared memory: " + name);
+        std::shared_ptr<segment> out(new segment(name, bytes));
+        out->map(fd, true);
+        new (out->header_) segment_header();
+        out->header_->refs = 1;
+        return out;
+#endif
+    }
+
+    /*
+     * Maps an existing segment by name. With `adopt` the caller takes over a reference
+     * that was added with add_ref() (typically by pickling), otherwise a new one is taken.
+     */
+    static std::shared_ptr<segment> attach(const std::string &name, size_t bytes, bool adopt) {
+#ifdef _WIN32
+        (void)name; (void)bytes; (void)adopt;
+        throw std::runtime_error("Shared memory outputs need POSIX shared memory");
+#else
+        const int fd = ::shm_open(name.c_str(), O_RDWR, 0600);
+        if (fd < 0)
+            throw std::invalid_argument("Shared memory no longer exists: " + name);
+        std::shared_ptr<segment> out(new segment(name, bytes));
+        out->map(fd, false);
+        if (!adopt)
+            out->header_->refs++;
+        return out;
+#endif
+    }
+
+    ~segment() {
+#ifndef _WIN32
+        if (!header_)
+            return;
+        const bool last = --header_->refs == 0;
+        ::munmap(header_, sizeof(segment_header) + size_);
+        if (last)
+            ::shm_unlink(name_.c_str());
+#endif
+    }
+
+    segment(const segment &) = delete;
+    segment &operator=(const segment &) = delete;
+
+    /* Keeps the segment alive for an attach that hasn't happened yet */
+    void add_ref() { header_->refs++; }
+
+    void *data() const { return header_ + 1; }
+    size_t size() const { return size_; }
+    const std::string &name() const { return name_; }
+
+private:
+    segment(const std::string &name, size_t bytes) : name_(name), size_(bytes) {}
+
+#ifndef _WIN32
+    void map(int fd, bool created) {
+        const size_t total = sizeof(segment_header) + size_;
+        struct stat st;
+        const bool sized = created ? ::ftruncate(fd, off_t(total)) == 0 : (::fstat(fd, &st) == 0 && size_t(st.st_size) >= total);
+        void *ptr = sized ? ::mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+        ::close(fd);
+        if (ptr == MAP_FAILED) {
+            if (created)
+                ::shm_unlink(name_.c_str());
+            throw std::runtime_error("Failed to map shared memory: " + name_);
+        }
+        header_ = static_cast<segment_header *>(ptr);
+    }
+#endif
+
+    std::string name_;
+    size_t size_ = 0;
+    segment_header *header_ = nullptr;
+};
+
+} // namespace shm
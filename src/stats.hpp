@@ -0,0 +1,175 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <type_traits>
+
+#include "float_convert.hpp"
+#include "transpose.hpp"
+
+
+/*
+ * Per-channel statistics gathered by load(stats=True) and stats_of() in the same loop that
+ * copies (and for half formats widens) the texels, so QA doesn't need a second pass in NumPy.
+ * Histograms have STATS_BINS bins over the full range of integer types, or over [0, 1] for
+ * float types with values outside clamped into the end bins. NaN / Inf are only counted,
+ * they are left out of every other statistic.
+ */
+constexpr size_t STATS_BINS = 256;
+
+
+struct channel_stats {
+    double min = std::numeric_limits<double>::quiet_NaN();
+    double max = std::numeric_limits<double>::quiet_NaN();
+    double sum = 0.0;
+    double sum_sq = 0.0;
+    std::uint64_t count = 0;    // finite values
+    std::uint64_t nan = 0;
+    std::uint64_t inf = 0;
+    std::array<std::uint64_t, STATS_BINS> histogram = {};
+
+    double mean() const {
+        return count ? sum / double(count) : std::numeric_limits<double>::quiet_NaN();
+    }
+
+    /* Population standard deviation */
+    double stddev() const {
+        if (!count)
+            return std::numeric_limits<double>::quiet_NaN();
+        const double m = mean();
+        return std::sqrt(std::max(sum_sq / double(count) - m * m, 0.0));
+    }
+};
+
+
+struct texture_stats {
+    std::vector<channel_stats> channels;
+};
+
+
+namespace detail {
+
+/* Pixels per block, small enough that 16 bit sums of squares can't overflow the integer accumulators */
+constexpr size_t STATS_BLOCK = 1024;
+
+
+template <typename S, typename T>
+inline T to_element(S v) {
+    if constexpr (std::is_same<S, T>::value)
+        return v;
+    else
+        return half_to_float(v);
+}
+
+
+template <typename T>
+inline size_t histogram_bin(T v) {
+    if constexpr (std::is_floating_point<T>::value) {
+        if (!(v > T(0)))
+            return 0;
+        return v >= T(1) ? STATS_BINS - 1 : size_t(v * T(STATS_BINS));
+    } else {
+        // Offset from the type's lowest value, top 8 bits
+        using U = std::make_unsigned_t<T>;
+        const U offset = U(U(v) - U(std::numeric_limits<T>::lowest()));
+        return size_t(offset >> (sizeof(T) * 8 - 8));
+    }
+}
+
+
+/*
+ * One channel of one block: `n` texels `C` elements apart, written `out_step` elements apart
+ * when Write. Min / max / sums stay in locals of the element type so the integer loops vectorise.
+ */
+template <bool Write, typename S, typename T, size_t C>
+void accumulate_block(const S *in, T *out, size_t out_step, size_t n, channel_stats &s) {
+    if constexpr (std::is_floating_point<T>::value) {
+        T lo = std::numeric_limits<T>::infinity();
+        T hi = -std::numeric_limits<T>::infinity();
+        double sum = 0.0, sum_sq = 0.0;
+        std::uint64_t nan = 0, inf = 0;
+        for (size_t i = 0; i < n; i++) {
+            const T v = to_element<S, T>(in[i * C]);
+            if constexpr (Write)
+                out[i * out_step] = v;
+            if (std::isnan(v)) {
+                nan++;
+            } else if (std::isinf(v)) {
+                inf++;
+            } else {
+                lo = std::min(lo, v);
+                hi = std::max(hi, v);
+                sum += double(v);
+                sum_sq += double(v) * double(v);
+                s.histogram[histogram_bin(v)]++;
+            }
+        }
+        const std::uint64_t finite = n - nan - inf;
+        if (finite) {
+            s.min = s.count ? std::min(s.min, double(lo)) : double(lo);
+            s.max = s.count ? std::max(s.max, double(hi)) : double(hi);
+        }
+        s.count += finite;
+        s.nan += nan;
+        s.inf += inf;
+        s.sum += sum;
+        s.sum_sq += sum_sq;
+    } else {
+        using sum_t = std::conditional_t<(sizeof(T) <= 2), std::int64_t, double>;
+        T lo = std::numeric_limits<T>::max();
+        T hi = std::numeric_limits<T>::lowest();
+        sum_t sum = 0, sum_sq = 0;
+        for (size_t i = 0; i < n; i++) {
+            const T v = in[i * C];
+            if constexpr (Write)
+                out[i * out_step] = v;
+            lo = std::min(lo, v);
+            hi = std::max(hi, v);
+            sum += sum_t(v);
+            sum_sq += sum_t(v) * sum_t(v);
+        }
+        for (size_t i = 0; i < n; i++)
+            s.histogram[histogram_bin(in[i * C])]++;
+        if (n) {
+            s.min = s.count ? std::min(s.min, double(lo)) : double(lo);
+            s.max = s.count ? std::max(s.max, double(hi)) : double(hi);
+        }
+        s.count += n;
+        s.sum += double(sum);
+        s.sum_sq += double(sum_sq);
+    }
+}
+
+} // namespace detail
+
+
+/*
+ * As load_texels(): converts `pixels` stored texels (S) to NumPy elements (T), interleaved or
+ * planar, while accumulating their statistics. `dst` may be null to only gather statistics.
+ * Bgr reads stored B, G, R(, A) texels into R, G, B(, A) order.
+ */
+template <typename S, typename T, size_t C, bool Bgr = false>
+void load_stats_texels(const void *src, void *dst, size_t pixels, bool planar, texture_stats &stats) {
+    const S *in = static_cast<const S *>(src);
+    T *out = static_cast<T *>(dst);
+    const size_t out_step = planar ? 1 : C;
+    stats.channels.assign(C, channel_stats());
+
+    for (size_t begin = 0; begin < pixels; begin += detail::STATS_BLOCK) {
+        const size_t n = std::min(detail::STATS_BLOCK, pixels - begin);
+        for (size_t c = 0; c < C; c++) {
+            const S *block_in = in + begin * C + (Bgr ? bgr_channel(c) : c);
+            if (!out) {
+                detail::accumulate_block<false, S, T, C>(block_in, nullptr, 0, n, stats.channels[c]);
+                continue;
+            }
+            T *block_out = planar ? out + c * pixels + begin : out + begin * C + c;
+            detail::accumulate_block<true, S, T, C>(block_in, block_out, out_step, n, stats.channels[c]);
+        }
+    }
+}
@@ -0,0 +1,3 @@
+// stb_image implementation, compiled once and shared by every target
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include <stb_image.h>
+#include <gli/gli.hpp>
+
+#include "buffer_pool.hpp"
+
+
+/*
+ * PNG / TGA / JPEG / HDR (and the other stb_image formats) decoded into the equivalent gli
+ * format, so they share the texel layouts and output paths of the gli containers.
+ * 8 bit images map to *8_UNORM, 16 bit to *16_UNORM and HDR to *32_SFLOAT.
+ */
+namespace stb {
+
+inline gli::format image_format(int channels, bool is_16_bit, bool is_hdr) {
+    static const gli::format u8[4] = {gli::FORMAT_R8_UNORM_PACK8, gli::FORMAT_RG8_UNORM_PACK8, gli::FORMAT_RGB8_UNORM_PACK8, gli::FORMAT_RGBA8_UNORM_PACK8};
+    static const gli::format u16[4] = {gli::FORMAT_R16_UNORM_PACK16, gli::FORMAT_RG16_UNORM_PACK16, gli::FORMAT_RGB16_UNORM_PACK16, gli::FORMAT_RGBA16_UNORM_PACK16};
+    static const gli::format f32[4] = {gli::FORMAT_R32_SFLOAT_PACK32, gli::FORMAT_RG32_SFLOAT_PACK32, gli::FORMAT_RGB32_SFLOAT_PACK32, gli::FORMAT_RGBA32_SFLOAT_PACK32};
+    if (channels < 1 || channels > 4)
+        throw std::invalid_argument("Unsupported image channel count: " + std::to_string(channels));
+    if (is_hdr)
+        return f32[channels - 1];
+    return is_16_bit ? u16[channels - 1] : u8[channels - 1];
+}
+
+
+/* Reads an image's format and size without decoding it, false if stb doesn't recognise the file */
+inline bool info(const std::string &filepath, gli::format &format, gli::extent3d &extent) {
+    int width = 0, height = 0, channels = 0;
+    if (!stbi_info(filepath.c_str(), &width, &height, &channels))
+        return false;
+    format = image_format(channels, stbi_is_16_bit(filepath.c_str()) != 0, stbi_is_hdr(filepath.c_str()) != 0);
+    extent = gli::extent3d(width, height, 1);
+    return true;
+}
+
+
+struct image {
+    std::unique_ptr<void, void (*)(void *)> pixels{nullptr, stbi_image_free};
+    gli::format format = gli::FORMAT_UNDEFINED;
+    size_t width = 0;
+    size_t height = 0;
+
+    /* A copy as a gli texture, for paths that need whole textures (load_texture(), the converter) */
+    gli::texture texture() const {
+        gli::texture tex(gli::TARGET_2D, format, gli::extent3d(width, height, 1), 1, 1, 1);
+        std::memcpy(tex.data(), pixels.get(), tex.size());
+        return tex;
+    }
+};
+
+
+/* Decodes an encoded image already in memory at its native channel count and bit depth */
+inline image load_from_memory(const void *data, size_t size, const std::string &name) {
+    const auto *buffer = static_cast<const stbi_uc *>(data);
+    const int len = static_cast<int>(size);
+    const bool is_hdr = stbi_is_hdr_from_memory(buffer, len) != 0;
+    const bool is_16_bit = !is_hdr && stbi_is_16_bit_from_memory(buffer, len) != 0;
+
+    int width = 0, height = 0, channels = 0;
+    void *pixels = nullptr;
+    if (is_hdr)
+        pixels = stbi_loadf_from_memory(buffer, len, &width, &height, &channels, 0);
+    else if (is_16_bit)
+        pixels = stbi_load_16_from_memory(buffer, len, &width, &height, &channels, 0);
+    else
+        pixels = stbi_load_from_memory(buffer, len, &width, &height, &channels, 0);
+    if (!pixels)
+        throw std::runtime_error("Failed to decode " + name + ": " + stbi_failure_reason());
+
+    image out;
+    out.pixels.reset(pixels);
+    out.format = image_format(channels, is_16_bit, is_hdr);
+    out.width = width;
+    out.height = height;
+    return out;
+}
+
+
+/* As load_from_memory(), the file is read once rather than reopened by each stb probe */
+inline image load(const std::string &filepath) {
+    std::ifstream file(filepath, std::ios::binary | std::ios::ate);
+    if (!file.good())
+        throw std::invalid_argument("File doesn't exist: " + filepath);
+    pool::buffer data = pool::acquire(size_t(file.tellg()));
+    file.seekg(0);
+    if (!file.read(data.chars(), data.size()))
+        throw std::runtime_error("Failed to read: " + filepath);
+    return load_from_memory(data.data(), data.size(), filepath);
+}
+
+} // namespace stb
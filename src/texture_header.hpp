@@ -0,0 +1,266 @@
+#pragma once
+
+#include <cstdint>
+#include <iterator>
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <fstream>
+#include <stdexcept>
+
+#include <gli/gli.hpp>
+
+#include "ktx2.hpp"
+#include "stb_io.hpp"
+
+
+/* Which decoder handles a file, sniffed from its leading magic bytes */
+enum class container {
+    gli,        // DDS, KTX, KMG
+    ktx2,       // native KTX2 reader
+    image,      // anything else is handed to stb_image (PNG, TGA, JPEG, HDR, ...)
+};
+
+
+/* The parts of a texture's header needed to size an output before decoding it */
+struct texture_header {
+    gli::format format = gli::FORMAT_UNDEFINED;
+    gli::extent3d extent = gli::extent3d(0, 0, 0);
+    size_t layers = 1;
+    size_t faces = 1;
+    size_t levels = 1;
+};
+
+
+namespace detail {
+
+struct dds_header {
+    std::uint32_t magic;
+    std::uint32_t size;
+    std::uint32_t flags;
+    std::uint32_t height;
+    std::uint32_t width;
+    std::uint32_t pitch;
+    std::uint32_t depth;
+    std::uint32_t levels;
+    std::uint32_t reserved1[11];
+    std::uint32_t pf_size;
+    std::uint32_t pf_flags;
+    std::uint32_t pf_four_cc;
+    std::uint32_t pf_bpp;
+    std::uint32_t pf_mask[4];
+    std::uint32_t caps;
+    std::uint32_t cubemap_flags;
+    std::uint32_t reserved2[3];
+};
+
+struct dds_header10 {
+    std::uint32_t format;
+    std::uint32_t dimension;
+    std::uint32_t misc_flags;
+    std::uint32_t array_size;
+    std::uint32_t alpha_flags;
+};
+
+struct ktx_header {
+    std::uint8_t identifier[12];
+    std::uint32_t endianness;
+    std::uint32_t gl_type;
+    std::uint32_t gl_type_size;
+    std::uint32_t gl_format;
+    std::uint32_t gl_internal_format;
+    std::uint32_t gl_base_internal_format;
+    std::uint32_t width;
+    std::uint32_t height;
+    std::uint32_t depth;
+    std::uint32_t layers;
+    std::uint32_t faces;
+    std::uint32_t levels;
+    std::uint32_t key_value_bytes;
+};
+
+constexpr std::uint32_t DDS_MAGIC = 0x20534444;         // "DDS "
+constexpr std::uint32_t DDSD_MIPMAPCOUNT = 0x20000;
+constexpr std::uint32_t DDSD_DEPTH = 0x800000;
+constexpr std::uint32_t DDPF_FOURCC = 0x4;
+constexpr std::uint32_t DDSCAPS2_CUBEMAP = 0x200;
+constexpr std::uint32_t D3D10_MISC_TEXTURECUBE = 0x4;
+constexpr std::uint8_t KTX_IDENTIFIER[12] = {0xAB, 0x4B, 0x54, 0x58, 0x20, 0x31, 0x31, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A};
+constexpr std::uint8_t KMG_IDENTIFIER[4] = {0xAB, 0x4B, 0x4D, 0x47};
+
+inline bool valid_format(gli::format format) {
+    return format >= gli::FORMAT_FIRST && format <= gli::FORMAT_LAST;
+}
+
+/*
+ * Format of a legacy DDS pixel format described by bit count and channel masks rather than a
+ * FourCC. Candidates are tried in the order gli's DDS loader tries them, against gli's own
+ * masks, so both agree on what such a file holds.
+ */
+inline gli::format find_dds_mask_format(const gli::dx &dx, const dds_header &header) {
+    static const gli::format BPP8[] = {
+        gli::FORMAT_RG4_UNORM_PACK8, gli::FORMAT_L8_UNORM_PACK8, gli::FORMAT_A8_UNORM_PACK8, gli::FORMAT_R8_UNORM_PACK8,
+        gli::FORMAT_RG3B2_UNORM_PACK8};
+    static const gli::format BPP16[] = {
+        gli::FORMAT_RGBA4_UNORM_PACK16, gli::FORMAT_BGRA4_UNORM_PACK16, gli::FORMAT_R5G6B5_UNORM_PACK16,
+        gli::FORMAT_B5G6R5_UNORM_PACK16, gli::FORMAT_RGB5A1_UNORM_PACK16, gli::FORMAT_BGR5A1_UNORM_PACK16,
+        gli::FORMAT_LA8_UNORM_PACK8, gli::FORMAT_RG8_UNORM_PACK8, gli::FORMAT_L16_UNORM_PACK16, gli::FORMAT_A16_UNORM_PACK16,
+        gli::FORMAT_R16_UNORM_PACK16};
+    static const gli::format BPP24[] = {gli::FORMAT_RGB8_UNORM_PACK8, gli::FORMAT_BGR8_UNORM_PACK8};
+    static const gli::format BPP32[] = {
+        gli::FORMAT_BGR8_UNORM_PACK32, gli::FORMAT_BGRA8_UNORM_PACK8, gli::FORMAT_RGBA8_UNORM_PACK8,
+        gli::FORMAT_RGB10A2_UNORM_PACK32, gli::FORMAT_LA16_UNORM_PACK16, gli::FORMAT_RG16_UNORM_PACK16,
+        gli::FORMAT_R32_SFLOAT_PACK32};
+
+    const gli::format *first = nullptr, *last = nullptr;
+    switch (header.pf_bpp) {
+        case 8: first = std::begin(BPP8); last = std::end(BPP8); break;
+        case 16: first = std::begin(BPP16); last = std::end(BPP16); break;
+        case 24: first = std::begin(BPP24); last = std::end(BPP24); break;
+        case 32: first = std::begin(BPP32); last = std::end(BPP32); break;
+        default: return gli::FORMAT_UNDEFINED;
+    }
+    for (const gli::format *f = first; f != last; f++) {
+        const auto &mask = dx.translate(*f).Mask;
+        if (mask[0] == header.pf_mask[0] && mask[1] == header.pf_mask[1] && mask[2] == header.pf_mask[2] && mask[3] == header.pf_mask[3])
+            return *f;
+    }
+    return gli::FORMAT_UNDEFINED;
+}
+
+inline bool read_dds_header(std::ifstream &file, texture_header &out) {
+    dds_header header;
+    file.seekg(0);
+    if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)) || header.magic != DDS_MAGIC)
+        return false;
+
+    gli::dx dx;
+    const auto four_cc = static_cast<gli::dx::d3dfmt>(header.pf_four_cc);
+    out.layers = 1;
+    out.faces = (header.cubemap_flags & DDSCAPS2_CUBEMAP) ? 6 : 1;
+    if (!(header.pf_flags & DDPF_FOURCC)) {
+        out.format = find_dds_mask_format(dx, header);
+    } else if (four_cc == gli::dx::D3DFMT_DX10 || four_cc == gli::dx::D3DFMT_GLI1) {
+        dds_header10 header10;
+        if (!file.read(reinterpret_cast<char *>(&header10), sizeof(header10)))
+            return false;
+        out.format = dx.find(four_cc, gli::dx::dxgiFormat(static_cast<gli::dx::dxgi_format_dds>(header10.format)));
+        out.layers = std::max<std::uint32_t>(header10.array_size, 1);
+        if (header10.misc_flags & D3D10_MISC_TEXTURECUBE)
+            out.faces = 6;
+    } else {
+        out.format = dx.find(four_cc);
+    }
+
+    out.extent = gli::extent3d(header.width, header.height, (header.flags & DDSD_DEPTH) ? std::max<std::uint32_t>(header.depth, 1) : 1);
+    out.levels = (header.flags & DDSD_MIPMAPCOUNT) ? std::max<std::uint32_t>(header.levels, 1) : 1;
+    return valid_format(out.format);
+}
+
+inline bool read_ktx_header(std::ifstream &file, texture_header &out) {
+    ktx_header header;
+    file.seekg(0);
+    if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)))
+        return false;
+    if (std::memcmp(header.identifier, KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER)) != 0 || header.endianness != 0x04030201)
+        return false;
+
+    gli::gl gl(gli::gl::PROFILE_KTX);
+    out.format = gl.find(
+        static_cast<gli::gl::internal_format>(header.gl_internal_format),
+        static_cast<gli::gl::external_format>(header.gl_format),
+        static_cast<gli::gl::type_format>(header.gl_type));
+    out.extent = gli::extent3d(header.width, std::max<std::uint32_t>(header.height, 1), std::max<std::uint32_t>(header.depth, 1));
+    out.layers = std::max<std::uint32_t>(header.layers, 1);
+    out.faces = std::max<std::uint32_t>(header.faces, 1);
+    out.levels = std::max<std::uint32_t>(header.levels, 1);
+    return valid_format(out.format);
+}
+
+inline bool read_ktx2_header(std::ifstream &file, texture_header &out) {
+    ktx2::header header;
+    file.seekg(0);
+    if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)) || !ktx2::is_ktx2(header.identifier, sizeof(header.identifier)))
+        return false;
+
+    out.format = static_cast<gli::format>(header.vk_format);
+    out.extent = gli::extent3d(header.width, std::max<std::uint32_t>(header.height, 1), std::max<std::uint32_t>(header.depth, 1));
+    out.layers = std::max<std::uint32_t>(header.layers, 1);
+    out.faces = std::max<std::uint32_t>(header.faces, 1);
+    out.levels = std::max<std::uint32_t>(header.levels, 1);
+    if (!ktx2::vk_compatible(out.format))
+        throw std::invalid_argument("Unrecognised KTX2 Format: " + std::to_string(header.vk_format));
+    return true;
+}
+
+inline bool read_image_header(const std::string &filepath, texture_header &out) {
+    if (!stb::info(filepath, out.format, out.extent))
+        return false;
+    out.layers = out.faces = out.levels = 1;
+    return true;
+}
+
+} // namespace detail
+
+
+/* Picks the decoder from the first (up to 12) bytes of a file */
+inline container sniff_container(const std::uint8_t *data, size_t size) {
+    std::uint8_t magic[12] = {};
+    std::memcpy(magic, data, std::min(size, sizeof(magic)));
+    std::uint32_t fourcc;
+    std::memcpy(&fourcc, magic, sizeof(fourcc));
+
+    if (ktx2::is_ktx2(magic, size))
+        return container::ktx2;
+    if (fourcc == detail::DDS_MAGIC
+        || std::memcmp(magic, detail::KTX_IDENTIFIER, sizeof(detail::KTX_IDENTIFIER)) == 0
+        || std::memcmp(magic, detail::KMG_IDENTIFIER, sizeof(detail::KMG_IDENTIFIER)) == 0)
+        return container::gli;
+    return container::image;
+}
+
+
+inline container sniff_container(const std::string &filepath) {
+    std::uint8_t magic[12] = {};
+    std::ifstream file(filepath, std::ios::binary);
+    file.read(reinterpret_cast<char *>(magic), sizeof(magic));
+    return sniff_container(magic, size_t(file.gcount()));
+}
+
+
+/*
+ * Reads the format and dimensions of a texture file without decoding its texel data.
+ * DDS (FourCC, DX10 and legacy mask headers), KTX, KTX2 and stb image headers are parsed
+ * directly, anything else (KMG) falls back to a full gli::load.
+ */
+inline texture_header read_header(const std::string &filepath) {
+    texture_header header;
+    {
+        std::ifstream file(filepath, std::ios::binary);
+        if (!file.good())
+            throw std::invalid_argument("File doesn't exist: " + filepath);
+        if (detail::read_dds_header(file, header))
+            return header;
+        file.clear();
+        if (detail::read_ktx_header(file, header))
+            return header;
+        file.clear();
+        if (detail::read_ktx2_header(file, header))
+            return header;
+    }
+    if (sniff_container(filepath) == container::image) {
+        if (!detail::read_image_header(filepath, header))
+            throw std::invalid_argument(std::string("Unrecognised file format: ") + filepath);
+        return header;
+    }
+
+    gli::texture tex = gli::load(filepath);
+    if (tex.empty())
+        throw std::runtime_error("Failed to load: " + filepath);
+    header.format = tex.format();
+    header.extent = tex.extent();
+    header.layers = tex.layers();
+    header.faces = tex.faces();
+    header.levels = tex.levels();
+    return header;
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <stdexcept>
+
+#include <gli/gli.hpp>
+
+#include "buffer_pool.hpp"
+#include "texture_header.hpp"
+#include "ktx2.hpp"
+#include "stb_io.hpp"
+
+
+/*
+ * Whole-texture file IO shared by the Python module and the pygli-convert tool.
+ * Nothing in here touches Python, so it is safe to call with the GIL released.
+ */
+
+inline bool file_exists (const std::string& name) {
+    std::ifstream f(name.c_str());
+    return f.good();
+}
+
+
+inline bool has_extension(const std::string &filepath, const std::string &ext) {
+    if (filepath.size() < ext.size())
+        return false;
+    std::string tail = filepath.substr(filepath.size() - ext.size());
+    std::transform(tail.begin(), tail.end(), tail.begin(), [](unsigned char c) { return std::tolower(c); });
+    return tail == ext;
+}
+
+
+inline std::vector<char> read_file(const std::string &filepath) {
+    std::ifstream file(filepath, std::ios::binary | std::ios::ate);
+    if (!file.good())
+        throw std::invalid_argument("File doesn't exist: " + filepath);
+    std::vector<char> data(size_t(file.tellg()));
+    file.seekg(0);
+    if (!file.read(data.data(), data.size()))
+        throw std::runtime_error("Failed to read: " + filepath);
+    return data;
+}
+
+
+/* As read_file(), into a buffer leased from the global pool */
+inline pool::buffer read_file_pooled(const std::string &filepath) {
+    std::ifstream file(filepath, std::ios::binary | std::ios::ate);
+    if (!file.good())
+        throw std::invalid_argument("File doesn't exist: " + filepath);
+    pool::buffer data = pool::acquire(size_t(file.tellg()));
+    file.seekg(0);
+    if (!file.read(data.chars(), data.size()))
+        throw std::runtime_error("Failed to read: " + filepath);
+    return data;
+}
+
+
+/* Decodes a whole texture file, KTX2 levels are decompressed in parallel */
+inline gli::texture load_texture(const std::string &filepath, size_t num_threads) {
+    switch (sniff_container(filepath)) {
+        case container::ktx2:
+            return ktx2::reader(filepath).texture(num_threads);
+        case container::image:
+            return stb::load(filepath).texture();
+        default:
+            break;
+    }
+    // gli reads files into a fresh vector, a pooled one saves that allocation
+    const pool::buffer data = read_file_pooled(filepath);
+    gli::texture tex = gli::load(data.chars(), data.size());
+    if (tex.empty())
+        throw std::runtime_error("Failed to load: " + filepath);
+    return tex;
+}
+
+
+/* As load_texture(), for a file already read into memory. `name` is only used in errors */
+inline gli::texture decode_texture(std::vector<char> &&data, const std::string &name, size_t num_threads) {
+    switch (sniff_container(reinterpret_cast<const std::uint8_t *>(data.data()), data.size())) {
+        case container::ktx2:
+            return ktx2::reader(std::move(data), name).texture(num_threads);
+        case container::image:
+            return stb::load_from_memory(data.data(), data.size(), name).texture();
+        default:
+            break;
+    }
+    gli::texture tex = gli::load(data.data(), data.size());
+    if (tex.empty())
+        throw std::runtime_error("Failed to load: " + name);
+    return tex;
+}
+
+
+/* Serialises a texture into the container named by `filepath`'s extension */
+inline std::vector<char> encode_texture(const gli::texture &tex, const std::string &filepath, int zstd_level, size_t num_threads) {
+    if (has_extension(filepath, ".ktx2"))
+        return ktx2::encode(tex, zstd_level, num_threads);
+
+    std::vector<char> data;
+    bool ok = false;
+    if (has_extension(filepath, ".dds"))
+        ok = gli::save_dds(tex, data);
+    else if (has_extension(filepath, ".ktx"))
+        ok = gli::save_ktx(tex, data);
+    else if (has_extension(filepath, ".kmg"))
+        ok = gli::save_kmg(tex, data);
+    else
+        throw std::invalid_argument("Unsupported output extension: " + filepath);
+    if (!ok)
+        throw std::runtime_error("Failed to encode: " + filepath);
+    return data;
+}
+
+
+/* Writes a texture to a DDS / KTX / KMG (via gli) or KTX2 file, picked by extension. KTX2 levels are encoded on num_threads (0 = one per core) */
+inline bool save_texture(const gli::texture &tex, const std::string &filepath, int zstd_level, size_t num_threads) {
+    if (has_extension(filepath, ".ktx2"))
+        return ktx2::save(tex, filepath, zstd_level, num_threads);
+    return gli::save(tex, filepath);
+}
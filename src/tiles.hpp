@@ -0,0 +1,391 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+#include <condition_variable>
+
+#include <zstd.h>
+
+#include "buffer_pool.hpp"
+#include "float_convert.hpp"
+#include "format_traits.hpp"
+#include "work_stealing.hpp"
+
+
+/*
+ * Virtual texture page file: a mip pyramid cut into square tiles, each tile carrying `border`
+ * texels of its neighbours (clamped at the image edges) so it can be filtered on its own.
+ *
+ *   header (64 bytes)
+ *   tiles, each (tile + 2 * border)^2 texels of the format, zstd compressed unless zstd_level is 0
+ *   index, one entry per tile sorted by level, y, x
+ *
+ * The pyramid is built out of core: rows of level 0 stream in from the top, each level keeps
+ * only the rows its current strip of tiles and the next level's box filter still need, and a
+ * strip is cut and compressed in parallel as soon as its last row arrives, on one set of
+ * worker threads kept for the whole pyramid. A writer thread
+ * appends finished strips while the next ones are built, with at most MAX_QUEUED waiting.
+ */
+namespace tiles {
+
+constexpr char MAGIC[8] = {'P', 'Y', 'G', 'L', 'I', 'V', 'T', '1'};
+constexpr std::uint32_t VERSION = 1;
+constexpr size_t MAX_QUEUED = 2;
+
+struct header {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t format;
+    std::uint32_t width;            // level 0
+    std::uint32_t height;
+    std::uint32_t tile;             // texels per side, without the border
+    std::uint32_t border;
+    std::uint32_t levels;
+    std::uint32_t compression;      // 0 = raw, 1 = zstd
+    std::uint64_t index_offset;     // entry[tile_count]
+    std::uint64_t tile_count;
+    std::uint64_t reserved;
+};
+
+struct entry {
+    std::uint64_t offset;
+    std::uint32_t size;
+    std::uint32_t level;
+    std::uint32_t x;                // in tiles
+    std::uint32_t y;
+};
+
+static_assert(sizeof(header) == 64, "page file header must be 64 bytes");
+static_assert(sizeof(entry) == 24, "page file entry must be 24 bytes");
+
+
+struct options {
+    size_t tile = 128;
+    size_t border = 4;
+    size_t levels = 0;          // 0 = down to the first level that fits in one tile
+    int zstd_level = 3;         // 0 stores tiles uncompressed
+    size_t num_threads = 0;
+};
+
+
+/* Levels down to the first one no bigger than a tile, or to 1x1 */
+inline size_t level_count(size_t width, size_t height, size_t tile) {
+    size_t levels = 1;
+    for (size_t w = width, h = height; std::max(w, h) > std::max<size_t>(tile, 1); w = std::max<size_t>(w / 2, 1), h = std::max<size_t>(h / 2, 1))
+        levels++;
+    return levels;
+}
+
+
+/* Levels the pyramid of a width x height image gets with `opts` */
+inline size_t pyramid_levels(size_t width, size_t height, const options &opts) {
+    return opts.levels ? std::min(opts.levels, level_count(width, height, 1)) : level_count(width, height, opts.tile);
+}
+
+
+struct encoded_tile {
+    std::uint32_t level = 0;
+    std::uint32_t x = 0;
+    std::uint32_t y = 0;
+    std::vector<char> data;
+};
+
+
+/* Appends strips of encoded tiles on its own thread, then writes the index and header */
+class page_writer {
+public:
+    page_writer(const std::string &filepath, const header &info) : filepath_(filepath), header_(info) {
+        file_.open(filepath, std::ios::binary | std::ios::trunc);
+        if (!file_)
+            throw std::runtime_error("Failed to open for writing: " + filepath);
+        file_.write(reinterpret_cast<const char *>(&header_), sizeof(header_));
+        offset_ = sizeof(header_);
+        thread_ = std::thread([this]() { run(); });
+    }
+
+    ~page_writer() { stop(); }
+
+    page_writer(const page_writer &) = delete;
+    page_writer &operator=(const page_writer &) = delete;
+
+    /* Blocks while MAX_QUEUED strips are waiting to be written */
+    void submit(std::vector<encoded_tile> &&strip) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        space_.wait(lock, [&]() { return queue_.size() < MAX_QUEUED || error_; });
+        if (error_)
+            std::rethrow_exception(error_);
+        queue_.push_back(std::move(strip));
+        lock.unlock();
+        ready_.notify_one();
+    }
+
+    /* Waits for every strip, then writes the index and the final header */
+    void finish() {
+        stop();
+        if (error_)
+            std::rethrow_exception(error_);
+
+        std::sort(entries_.begin(), entries_.end(), [](const entry &a, const entry &b) {
+            return a.level != b.level ? a.level < b.level : (a.y != b.y ? a.y < b.y : a.x < b.x);
+        });
+        header_.index_offset = offset_;
+        header_.tile_count = entries_.size();
+        file_.write(reinterpret_cast<const char *>(entries_.data()), std::streamsize(entries_.size() * sizeof(entry)));
+        file_.seekp(0);
+        file_.write(reinterpret_cast<const char *>(&header_), sizeof(header_));
+        file_.flush();
+        if (!file_)
+            throw std::runtime_error("Failed to write: " + filepath_);
+    }
+
+    size_t tile_count() const { return entries_.size(); }
+
+private:
+    void run() {
+        for (;;) {
+            std::vector<encoded_tile> strip;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                ready_.wait(lock, [&]() { return done_ || !queue_.empty(); });
+                if (queue_.empty())
+                    return;
+                strip = std::move(queue_.front());
+                queue_.pop_front();
+            }
+            space_.notify_one();
+
+            for (const encoded_tile &t : strip) {
+                entries_.push_back({offset_, std::uint32_t(t.data.size()), t.level, t.x, t.y});
+                file_.write(t.data.data(), std::streamsize(t.data.size()));
+                offset_ += t.data.size();
+            }
+            if (!file_) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                error_ = std::make_exception_ptr(std::runtime_error("Failed to write: " + filepath_));
+                queue_.clear();
+                space_.notify_all();
+                return;
+            }
+        }
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            done_ = true;
+        }
+        ready_.notify_all();
+        if (thread_.joinable())
+            thread_.join();
+    }
+
+    std::string filepath_;
+    header header_;
+    std::ofstream file_;
+    std::uint64_t offset_ = 0;
+    std::vector<entry> entries_;    // only touched by the writer thread until it is joined
+
+    std::mutex mutex_;
+    std::condition_variable space_;
+    std::condition_variable ready_;
+    std::deque<std::vector<encoded_tile>> queue_;
+    bool done_ = false;
+    std::exception_ptr error_;
+    std::thread thread_;
+};
+
+
+/*
+ * Builds and cuts the pyramid from rows of level 0 pushed in order. Rows are kept in the
+ * format's NumPy element type (float for half formats, narrowed again when a tile is cut) so
+ * the next level can be box filtered with the format's resize kernel.
+ */
+class pyramid {
+public:
+    pyramid(const format_traits &traits, size_t width, size_t height, const options &opts, page_writer &writer)
+        : traits_(traits), opts_(opts), writer_(writer),
+          element_size_(traits.half ? sizeof(float) : traits.texel_size / traits.channels),
+          texel_size_(element_size_ * traits.channels), workers_(opts.num_threads) {
+        const size_t count = pyramid_levels(width, height, opts);
+        const size_t capacity = opts.tile + 2 * opts.border + 2;
+        for (size_t l = 0; l < count; l++) {
+            level lv;
+            lv.width = std::max<size_t>(width >> l, 1);
+            lv.height = std::max<size_t>(height >> l, 1);
+            lv.capacity = capacity;
+            lv.rows = pool::acquire(capacity * lv.width * texel_size_);
+            levels_.push_back(std::move(lv));
+        }
+        if (traits.half)
+            packed_ = pool::acquire(width * traits.texel_size);
+    }
+
+    size_t levels() const { return levels_.size(); }
+
+    /* Rows of level 0 in the format's stored element type (e.g. float16 bits), strides in bytes */
+    void push_rows(const void *src, std::ptrdiff_t row_stride, std::ptrdiff_t texel_stride, size_t rows) {
+        level &base = levels_[0];
+        if (pushed_ + rows > base.height)
+            throw std::invalid_argument("More rows than the image height");
+        for (size_t r = 0; r < rows; r++) {
+            const auto *row = static_cast<const std::uint8_t *>(src) + std::ptrdiff_t(r) * row_stride;
+            std::uint8_t *slot = next_slot(0);
+            if (traits_.half) {
+                traits_.save(row, row_stride, texel_stride, packed_.data(), 1, base.width);
+                traits_.load(packed_.data(), slot, base.width, false);
+            } else {
+                traits_.save(row, row_stride, texel_stride, slot, 1, base.width);
+            }
+            advance(0);
+        }
+        pushed_ += rows;
+    }
+
+    /* Checks the whole image arrived, every strip of every level has then been cut */
+    void finish() {
+        if (pushed_ != levels_[0].height)
+            throw std::invalid_argument("Source gave " + std::to_string(pushed_) + " of " + std::to_string(levels_[0].height) + " rows");
+    }
+
+private:
+    struct level {
+        size_t width = 0;
+        size_t height = 0;
+        size_t capacity = 0;
+        pool::buffer rows;
+        size_t first = 0;           // image row held at rows[0]
+        size_t count = 0;
+        size_t next_strip = 0;
+        size_t next_down = 0;       // next row of the level below to filter
+    };
+
+    std::uint8_t *row(size_t l, size_t y) {
+        level &lv = levels_[l];
+        return lv.rows.data() + (y - lv.first) * lv.width * texel_size_;
+    }
+
+    std::uint8_t *next_slot(size_t l) {
+        level &lv = levels_[l];
+        if (lv.count == lv.capacity)
+            throw std::logic_error("Tile row window overflowed");
+        return lv.rows.data() + lv.count * lv.width * texel_size_;
+    }
+
+    /* A row was written to next_slot(l): feed the level below, cut finished strips and drop spent rows */
+    void advance(size_t l) {
+        level &lv = levels_[l];
+        lv.count++;
+        const size_t last = lv.first + lv.count - 1;
+
+        if (l + 1 < levels_.size()) {
+            level &below = levels_[l + 1];
+            while (lv.next_down < below.height && std::min(2 * lv.next_down + 1, lv.height - 1) <= last) {
+                const size_t y = 2 * lv.next_down;
+                traits_.resize(row(l, y), lv.width, std::min<size_t>(2, lv.height - y), next_slot(l + 1), below.width, 1, resize_filter::box, 1);
+                lv.next_down++;
+                advance(l + 1);
+            }
+        }
+
+        const size_t strips = (lv.height + opts_.tile - 1) / opts_.tile;
+        while (lv.next_strip < strips && std::min(lv.height - 1, (lv.next_strip + 1) * opts_.tile + opts_.border - 1) <= last) {
+            cut_strip(l, lv.next_strip);
+            lv.next_strip++;
+        }
+
+        size_t keep = lv.next_strip < strips ? lv.next_strip * opts_.tile - std::min(lv.next_strip * opts_.tile, opts_.border) : lv.height;
+        if (l + 1 < levels_.size() && lv.next_down < levels_[l + 1].height)
+            keep = std::min(keep, 2 * lv.next_down);
+        keep = std::min(keep, last + 1);
+        if (keep > lv.first) {
+            const size_t dropped = keep - lv.first;
+            const size_t row_bytes = lv.width * texel_size_;
+            std::memmove(lv.rows.data(), lv.rows.data() + dropped * row_bytes, (lv.count - dropped) * row_bytes);
+            lv.first = keep;
+            lv.count -= dropped;
+        }
+    }
+
+    /* Stores `count` working texels in the format's storage layout */
+    void store(const std::uint8_t *src, std::uint8_t *dst, size_t count) const {
+        if (!traits_.half) {
+            std::memcpy(dst, src, count * texel_size_);
+            return;
+        }
+        const auto *in = reinterpret_cast<const float *>(src);
+        for (size_t i = 0; i < count * traits_.channels; i++) {
+            const std::uint16_t h = float_to_half(in[i]);
+            std::memcpy(dst + i * sizeof(h), &h, sizeof(h));
+        }
+    }
+
+    /* Cuts, converts and compresses the tiles of one strip on the workers, then queues them for writing */
+    void cut_strip(size_t l, size_t ty) {
+        level &lv = levels_[l];
+        const size_t tile = opts_.tile, border = opts_.border, side = tile + 2 * border;
+        const size_t columns = (lv.width + tile - 1) / tile;
+        const size_t stored = traits_.texel_size;
+        auto clamp = [](std::ptrdiff_t v, size_t size) { return size_t(std::min<std::ptrdiff_t>(std::max<std::ptrdiff_t>(v, 0), std::ptrdiff_t(size) - 1)); };
+
+        std::vector<encoded_tile> strip(columns);
+        auto cut = [&](size_t tx) {
+            pool::buffer raw = pool::acquire(side * side * stored);
+            const std::ptrdiff_t x0 = std::ptrdiff_t(tx * tile) - std::ptrdiff_t(border);
+            const std::ptrdiff_t y0 = std::ptrdiff_t(ty * tile) - std::ptrdiff_t(border);
+
+            // Columns of the tile inside the image, the rest repeat the edge texels
+            const size_t lead = size_t(std::min<std::ptrdiff_t>(std::max<std::ptrdiff_t>(-x0, 0), std::ptrdiff_t(side)));
+            const size_t inside = std::min(side - lead, size_t(std::max<std::ptrdiff_t>(std::ptrdiff_t(lv.width) - x0 - std::ptrdiff_t(lead), 0)));
+            for (size_t i = 0; i < side; i++) {
+                const std::uint8_t *src = row(l, clamp(y0 + std::ptrdiff_t(i), lv.height));
+                std::uint8_t *dst = raw.data() + i * side * stored;
+                const std::uint8_t *first = src, *last = src + (lv.width - 1) * texel_size_;
+                for (size_t j = 0; j < lead; j++)
+                    store(first, dst + j * stored, 1);
+                store(src + size_t(x0 + std::ptrdiff_t(lead)) * texel_size_, dst + lead * stored, inside);
+                for (size_t j = lead + inside; j < side; j++)
+                    store(last, dst + j * stored, 1);
+            }
+
+            encoded_tile &out = strip[tx];
+            out.level = std::uint32_t(l);
+            out.x = std::uint32_t(tx);
+            out.y = std::uint32_t(ty);
+            if (opts_.zstd_level > 0) {
+                out.data.resize(ZSTD_compressBound(raw.size()));
+                const size_t size = ZSTD_compress(out.data.data(), out.data.size(), raw.data(), raw.size(), opts_.zstd_level);
+                if (ZSTD_isError(size))
+                    throw std::runtime_error(std::string("Zstd compression failed: ") + ZSTD_getErrorName(size));
+                out.data.resize(size);
+            } else {
+                out.data.assign(raw.chars(), raw.chars() + raw.size());
+            }
+        };
+        for (size_t tx = 0; tx < columns; tx++)
+            workers_.submit([&cut, tx]() { cut(tx); });
+        workers_.wait();
+        writer_.submit(std::move(strip));
+    }
+
+    const format_traits &traits_;
+    const options opts_;
+    page_writer &writer_;
+    const size_t element_size_;     // of the rows kept per level
+    const size_t texel_size_;
+    std::vector<level> levels_;
+    pool::buffer packed_;           // one level 0 row in storage layout, half formats only
+    size_t pushed_ = 0;
+    work_stealing_pool workers_;    // started once, every strip of every level is cut on it
+};
+
+} // namespace tiles
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+
+/*
+ * Cache-blocked conversion between interleaved (HWC) and planar (CHW) texel storage.
+ * Pixels are processed in blocks small enough that the interleaved side stays in L1
+ * while each channel is streamed to / from its own contiguous plane. The channel count
+ * is a template parameter so the inner loops have fixed strides and can be vectorised.
+ */
+constexpr size_t TRANSPOSE_BLOCK = 512;
+
+
+/* Stored B, G, R(, A) <-> NumPy R, G, B(, A): channels 0 and 2 trade places, in both directions */
+constexpr size_t bgr_channel(size_t c) {
+    return c == 0 ? 2 : (c == 2 ? 0 : c);
+}
+
+
+template <size_t C, typename Src, typename Dst, typename Convert>
+void deinterleave_n(const Src *src, Dst *dst, size_t pixels, Convert convert) {
+    for (size_t p0 = 0; p0 < pixels; p0 += TRANSPOSE_BLOCK) {
+        const size_t n = std::min(TRANSPOSE_BLOCK, pixels - p0);
+        const Src *in = src + p0 * C;
+        for (size_t c = 0; c < C; c++) {
+            Dst *out = dst + c * pixels + p0;
+            for (size_t p = 0; p < n; p++)
+                out[p] = convert(in[p * C + c]);
+        }
+    }
+}
+
+
+template <size_t C, typename T>
+void interleave_n(const T *src, T *dst, size_t pixels) {
+    for (size_t p0 = 0; p0 < pixels; p0 += TRANSPOSE_BLOCK) {
+        const size_t n = std::min(TRANSPOSE_BLOCK, pixels - p0);
+        T *out = dst + p0 * C;
+        for (size_t c = 0; c < C; c++) {
+            const T *in = src + c * pixels + p0;
+            for (size_t p = 0; p < n; p++)
+                out[p * C + c] = in[p];
+        }
+    }
+}
+
+
+/* HWC -> CHW, converting each element with `convert` */
+template <typename Src, typename Dst, typename Convert>
+void deinterleave(const Src *src, Dst *dst, size_t pixels, size_t channels, Convert convert) {
+    switch (channels) {
+        case 1: deinterleave_n<1>(src, dst, pixels, convert); break;
+        case 2: deinterleave_n<2>(src, dst, pixels, convert); break;
+        case 3: deinterleave_n<3>(src, dst, pixels, convert); break;
+        case 4: deinterleave_n<4>(src, dst, pixels, convert); break;
+        default:
+            throw std::invalid_argument("Unsupported channel count: " + std::to_string(channels));
+    }
+}
+
+
+/* CHW -> HWC */
+template <typename T>
+void interleave(const T *src, T *dst, size_t pixels, size_t channels) {
+    switch (channels) {
+        case 1: std::memcpy(dst, src, pixels * sizeof(T)); break;
+        case 2: interleave_n<2>(src, dst, pixels); break;
+        case 3: interleave_n<3>(src, dst, pixels); break;
+        case 4: interleave_n<4>(src, dst, pixels); break;
+        default:
+            throw std::invalid_argument("Unsupported channel count: " + std::to_string(channels));
+    }
+}
+
+
+/* Type-erased variants, elements are moved as raw bits of `itemsize` bytes */
+inline void deinterleave_raw(const void *src, void *dst, size_t pixels, size_t channels, size_t itemsize) {
+    auto same = [](auto v) { return v; };
+    switch (itemsize) {
+        case 1: deinterleave(static_cast<const std::uint8_t *>(src), static_cast<std::uint8_t *>(dst), pixels, channels, same); break;
+        case 2: deinterleave(static_cast<const std::uint16_t *>(src), static_cast<std::uint16_t *>(dst), pixels, channels, same); break;
+        case 4: deinterleave(static_cast<const std::uint32_t *>(src), static_cast<std::uint32_t *>(dst), pixels, channels, same); break;
+        case 8: deinterleave(static_cast<const std::uint64_t *>(src), static_cast<std::uint64_t *>(dst), pixels, channels, same); break;
+        default:
+            throw std::invalid_argument("Unsupported element size: " + std::to_string(itemsize));
+    }
+}
+
+
+inline void interleave_raw(const void *src, void *dst, size_t pixels, size_t channels, size_t itemsize) {
+    switch (itemsize) {
+        case 1: interleave(static_cast<const std::uint8_t *>(src), static_cast<std::uint8_t *>(dst), pixels, channels); break;
+        case 2: interleave(static_cast<const std::uint16_t *>(src), static_cast<std::uint16_t *>(dst), pixels, channels); break;
+        case 4: interleave(static_cast<const std::uint32_t *>(src), static_cast<std::uint32_t *>(dst), pixels, channels); break;
+        case 8: interleave(static_cast<const std::uint64_t *>(src), static_cast<std::uint64_t *>(dst), pixels, channels); break;
+        default:
+            throw std::invalid_argument("Unsupported element size: " + std::to_string(itemsize));
+    }
+}
+
+
+/* Swaps channels 0 and 2 of interleaved texels in place, RGB(A) <-> BGR(A) */
+inline void swap_red_blue(void *texels, size_t pixels, size_t channels, size_t itemsize) {
+    auto *texel = static_cast<std::uint8_t *>(texels);
+    const size_t texel_size = channels * itemsize;
+    for (size_t p = 0; p < pixels; p++, texel += texel_size)
+        std::swap_ranges(texel, texel + itemsize, texel + 2 * itemsize);
+}
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstddef>
+
+#include "parallel.hpp"
+
+
+/*
+ * Thread pool where every worker owns a deque of tasks. A worker pushes and pops at the
+ * back of its own deque, so a task submitted from inside another task (the next pipeline
+ * stage of the same file) runs next on the same thread while its data is still in cache.
+ * Idle workers steal from the front of the other deques, taking the oldest work first.
+ * Tasks submitted from outside the pool are dealt round-robin across the workers.
+ */
+class work_stealing_pool {
+public:
+    using task = std::function<void()>;
+
+    explicit work_stealing_pool(size_t num_threads = 0) {
+        const size_t count = default_num_threads(num_threads);
+        for (size_t i = 0; i < count; i++)
+            queues_.emplace_back(new queue);
+        for (size_t i = 0; i < count; i++)
+            threads_.emplace_back([this, i]() { run(i); });
+    }
+
+    ~work_stealing_pool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        work_cv_.notify_all();
+        for (auto &thread : threads_)
+            thread.join();
+    }
+
+    work_stealing_pool(const work_stealing_pool &) = delete;
+    work_stealing_pool &operator=(const work_stealing_pool &) = delete;
+
+    size_t size() const { return threads_.size(); }
+
+    void submit(task t) {
+        pending_++;
+        const size_t i = (current_pool() == this) ? current_index() : next_++ % queues_.size();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queued_++;
+        }
+        {
+            std::lock_guard<std::mutex> lock(queues_[i]->mutex);
+            queues_[i]->tasks.push_back(std::move(t));
+        }
+        work_cv_.notify_one();
+    }
+
+    /* Blocks until every submitted task (and anything they submitted) has finished.
+       Rethrows the first exception that escaped a task */
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_cv_.wait(lock, [this]() { return pending_ == 0; });
+        if (error_) {
+            std::exception_ptr error = error_;
+            error_ = nullptr;
+            std::rethrow_exception(error);
+        }
+    }
+
+private:
+    struct queue {
+        std::mutex mutex;
+        std::deque<task> tasks;
+    };
+
+    static const work_stealing_pool *&current_pool() {
+        thread_local const work_stealing_pool *pool = nullptr;
+        return pool;
+    }
+
+    static size_t &current_index() {
+        thread_local size_t index = 0;
+        return index;
+    }
+
+    bool pop(size_t i, task &t) {
+        std::lock_guard<std::mutex> lock(queues_[i]->mutex);
+        if (queues_[i]->tasks.empty())
+            return false;
+        t = std::move(queues_[i]->tasks.back());
+        queues_[i]->tasks.pop_back();
+        return true;
+    }
+
+    bool steal(size_t i, task &t) {
+        for (size_t n = 1; n < queues_.size(); n++) {
+            queue &victim = *queues_[(i + n) % queues_.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                t = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run(size_t i) {
+        current_pool() = this;
+        current_index() = i;
+        for (;;) {
+            task t;
+            if (pop(i, t) || steal(i, t)) {
+                queued_--;
+                try {
+                    t();
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    if (!error_)
+                        error_ = std::current_exception();
+                }
+                t = nullptr;
+                if (--pending_ == 0) {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    done_cv_.notify_all();
+                }
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(mutex_);
+            work_cv_.wait(lock, [this]() { return stop_ || queued_ > 0; });
+            if (stop_ && queued_ == 0)
+                return;
+        }
+    }
+
+    std::vector<std::unique_ptr<queue>> queues_;
+    std::vector<std::thread> threads_;
+    std::atomic<size_t> pending_{0};    // submitted and not yet finished
+    std::atomic<size_t> queued_{0};     // sitting in a deque
+    std::atomic<size_t> next_{0};
+    std::mutex mutex_;
+    std::condition_variable work_cv_;
+    std::condition_variable done_cv_;
+    std::exception_ptr error_;
+    bool stop_ = false;
+};
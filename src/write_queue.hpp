@@ -0,0 +1,226 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+#include <exception>
+#include <functional>
+#include <condition_variable>
+
+
+/*
+ * Write-behind queue for save_async(): a small pool of native threads runs queued writes in
+ * order of submission. At most max_queued writes wait to start; submitting more blocks the
+ * producer until a worker takes one, so a producer that outruns the disk is slowed down
+ * rather than buffering without bound. Workers start on the first submit.
+ */
+namespace writeback {
+
+constexpr size_t DEFAULT_WORKERS = 2;
+constexpr size_t DEFAULT_MAX_QUEUED = 16;
+
+
+/* Completion of one queued write, shared by its worker and its future */
+class job {
+public:
+    bool done() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return done_;
+    }
+
+    void wait() const {
+        std::unique_lock<std::mutex> lock(mutex_);
+        finished_.wait(lock, [&]() { return done_; });
+    }
+
+    /* False if the write is still running after `seconds` */
+    bool wait_for(double seconds) const {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return finished_.wait_for(lock, std::chrono::duration<double>(seconds), [&]() { return done_; });
+    }
+
+    /* Null when the write succeeded, only meaningful once done() */
+    std::exception_ptr error() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return error_;
+    }
+
+private:
+    friend class writer_pool;
+
+    void complete(std::exception_ptr error) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            done_ = true;
+            error_ = error;
+        }
+        finished_.notify_all();
+    }
+
+    mutable std::mutex mutex_;
+    mutable std::condition_variable finished_;
+    bool done_ = false;
+    std::exception_ptr error_;
+};
+
+
+struct queue_stats {
+    size_t queued = 0;          // waiting for a worker
+    size_t active = 0;          // being written
+    size_t completed = 0;
+    size_t failed = 0;
+    size_t workers = 0;
+    size_t max_queued = 0;
+    double last_latency = 0.0;  // seconds from submit to the file being written
+    double mean_latency = 0.0;
+    double max_latency = 0.0;
+};
+
+
+class writer_pool {
+public:
+    writer_pool() = default;
+
+    ~writer_pool() { stop(); }
+
+    writer_pool(const writer_pool &) = delete;
+    writer_pool &operator=(const writer_pool &) = delete;
+
+    /* The process wide queue behind save_async() */
+    static writer_pool &global() {
+        static writer_pool instance;
+        return instance;
+    }
+
+    /* Queues `task`, blocking while max_queued writes are already waiting */
+    std::shared_ptr<job> submit(std::function<void()> task) {
+        auto state = std::make_shared<job>();
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            space_.wait(lock, [&]() { return !stopping_ && queue_.size() < max_queued_; });
+            if (threads_.empty())
+                for (size_t i = 0; i < workers_; i++)
+                    threads_.emplace_back([this]() { work(); });
+            queue_.push_back({std::move(task), state, clock::now()});
+        }
+        ready_.notify_one();
+        return state;
+    }
+
+    /* Blocks until every write submitted so far has finished */
+    void flush() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        idle_.wait(lock, [&]() { return queue_.empty() && active_ == 0; });
+    }
+
+    /* Finishes the queued writes, then applies the new limits (workers restart on the next submit) */
+    void configure(size_t workers, size_t max_queued) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            workers_ = std::max<size_t>(workers, 1);
+            max_queued_ = std::max<size_t>(max_queued, 1);
+        }
+        stop();
+    }
+
+    queue_stats stats() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_stats out;
+        out.queued = queue_.size();
+        out.active = active_;
+        out.completed = completed_;
+        out.failed = failed_;
+        out.workers = workers_;
+        out.max_queued = max_queued_;
+        out.last_latency = last_latency_;
+        out.mean_latency = completed_ + failed_ > 0 ? total_latency_ / double(completed_ + failed_) : 0.0;
+        out.max_latency = max_latency_;
+        return out;
+    }
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    struct item {
+        std::function<void()> task;
+        std::shared_ptr<job> state;
+        clock::time_point submitted;
+    };
+
+    void work() {
+        for (;;) {
+            item next;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                ready_.wait(lock, [&]() { return stopping_ || !queue_.empty(); });
+                if (queue_.empty())
+                    return;
+                next = std::move(queue_.front());
+                queue_.pop_front();
+                active_++;
+            }
+            space_.notify_one();
+
+            std::exception_ptr error;
+            try {
+                next.task();
+            } catch (...) {
+                error = std::current_exception();
+            }
+            next.task = nullptr;
+            const double latency = std::chrono::duration<double>(clock::now() - next.submitted).count();
+            next.state->complete(error);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                active_--;
+                (error ? failed_ : completed_)++;
+                last_latency_ = latency;
+                total_latency_ += latency;
+                max_latency_ = std::max(max_latency_, latency);
+            }
+            idle_.notify_all();
+        }
+    }
+
+    /* Lets the workers drain the queue and joins them, submits wait meanwhile */
+    void stop() {
+        std::vector<std::thread> threads;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+            threads.swap(threads_);
+        }
+        ready_.notify_all();
+        for (auto &thread : threads)
+            thread.join();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = false;
+        }
+        space_.notify_all();
+    }
+
+    mutable std::mutex mutex_;
+    std::condition_variable ready_;     // an item was queued, or stopping
+    std::condition_variable space_;     // the queue dropped below max_queued_, or stopping ended
+    std::condition_variable idle_;      // a write finished
+    std::deque<item> queue_;
+    std::vector<std::thread> threads_;
+    size_t workers_ = DEFAULT_WORKERS;
+    size_t max_queued_ = DEFAULT_MAX_QUEUED;
+    bool stopping_ = false;
+    size_t active_ = 0;
+    size_t completed_ = 0;
+    size_t failed_ = 0;
+    double last_latency_ = 0.0;
+    double total_latency_ = 0.0;
+    double max_latency_ = 0.0;
+};
+
+} // namespace writeback
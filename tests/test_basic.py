@@ -1,9 +1,36 @@
 import pygli
+import pickle
 import shutil
+import struct
+import zlib
 import numpy as np
 from pathlib import Path
 
 
+def write_png(path, img):
+    # Minimal 8 / 16 bit PNG writer so tests don't need an imaging library
+    h, w, c = img.shape
+    depth = img.dtype.itemsize * 8
+    color = {1: 0, 2: 4, 3: 2, 4: 6}[c]
+    rows = b"".join(b"\x00" + row.astype(img.dtype.newbyteorder(">")).tobytes() for row in img)
+    def chunk(tag, data):
+        return struct.pack(">I", len(data)) + tag + data + struct.pack(">I", zlib.crc32(tag + data))
+    with open(path, "wb") as f:
+        f.write(b"\x89PNG\r\n\x1a\n")
+        f.write(chunk(b"IHDR", struct.pack(">IIBBBBB", w, h, depth, color, 0, 0, 0)))
+        f.write(chunk(b"IDAT", zlib.compress(rows)))
+        f.write(chunk(b"IEND", b""))
+
+
+def write_tga(path, img):
+    # Uncompressed, top-left origin BGR(A) TGA
+    h, w, c = img.shape
+    header = struct.pack("<BBBHHBHHHHBB", 0, 0, 2, 0, 0, 0, 0, 0, w, h, c * 8, 0x20)
+    bgr = img[..., [2, 1, 0, 3][:c]]
+    with open(path, "wb") as f:
+        f.write(header + bgr.tobytes())
+
+
 def test_version():
     assert pygli.__version__ == "0.0.1"
 
@@ -34,6 +61,648 @@ def test_load():
     assert(failed)
 
 
+def test_load_batch():
+    paths = ["data/kueken7_rgba16_sfloat.dds"] * 3
+    batch = pygli.load_batch(paths)
+    assert list(batch.shape) == [3, 256, 256, 4]
+    assert batch.dtype == np.float32
+    assert batch.flags["C_CONTIGUOUS"]
+    single = pygli.load(paths[0])
+    for img in batch:
+        assert np.array_equal(img, single)
+
+    # Decode into a caller-provided array
+    out = np.zeros([2, 256, 256, 4], dtype=np.uint8)
+    ret = pygli.load_batch(["data/kueken7_rgba8_unorm.dds"] * 2, out=out, num_threads=2)
+    assert np.shares_memory(ret, out)
+    assert np.array_equal(out[1], pygli.load("data/kueken7_rgba8_unorm.dds"))
+
+    # Mixed formats are rejected before decoding
+    failed = False
+    try:
+        pygli.load_batch(["data/kueken7_rgba8_unorm.dds", "data/kueken7_rgba16_sfloat.dds"])
+    except:
+        failed = True
+    assert(failed)
+
+
+def test_load_chw():
+    hwc = pygli.load("data/kueken7_rgba16_sfloat.dds")
+    chw = pygli.load("data/kueken7_rgba16_sfloat.dds", layout="CHW")
+    assert list(chw.shape) == [4, 256, 256]
+    assert np.array_equal(chw, hwc.transpose(2, 0, 1))
+
+    batch = pygli.load_batch(["data/kueken7_rgba8_unorm.dds"] * 2, layout="NCHW")
+    assert list(batch.shape) == [2, 4, 256, 256]
+    assert np.array_equal(batch[1], pygli.load("data/kueken7_rgba8_unorm.dds").transpose(2, 0, 1))
+
+
+def test_save_chw():
+    out_dir = Path("test_output_chw")
+    out_dir.mkdir(parents=True, exist_ok=True)
+    chw = np.random.randint(0, 255, size=[4, 64, 128], dtype=np.uint8)
+    path_out = f"{str(out_dir)}/chw.dds"
+    assert pygli.save(path_out, chw, pygli.Format.RGBA8_UNORM_PACK8, layout="CHW")
+    assert np.array_equal(pygli.load(path_out, layout="CHW"), chw)
+    assert np.array_equal(pygli.load(path_out), chw.transpose(1, 2, 0))
+
+    # Tidy Up
+    shutil.rmtree(out_dir)
+
+
+def test_save_layers():
+    out_dir = Path("test_output_layers")
+    out_dir.mkdir(parents=True, exist_ok=True)
+    shapes = {
+        "array.dds": ([3, 64, 64, 4], None),
+        "cube.dds": ([6, 64, 64, 4], pygli.Target.TARGET_CUBE),
+        "volume.dds": ([8, 64, 64, 4], pygli.Target.TARGET_3D),
+        "cube_array.dds": ([2, 6, 64, 64, 4], None),
+    }
+    for name, (shape, target) in shapes.items():
+        arr = np.random.randint(0, 255, size=shape, dtype=np.uint8)
+        path_out = f"{str(out_dir)}/{name}"
+        assert pygli.save(path_out, arr, pygli.Format.RGBA8_UNORM_PACK8, target=target)
+        first = arr.reshape([-1, 64, 64, 4])[0]
+        assert np.array_equal(pygli.load(path_out), first)
+
+    # Cubemaps need exactly 6 faces
+    failed = False
+    try:
+        arr = np.zeros([4, 64, 64, 4], dtype=np.uint8)
+        pygli.save(f"{str(out_dir)}/bad.dds", arr, pygli.Format.RGBA8_UNORM_PACK8, target=pygli.Target.TARGET_CUBE)
+    except:
+        failed = True
+    assert(failed)
+
+    # Tidy Up
+    shutil.rmtree(out_dir)
+
+
+def test_ktx2():
+    out_dir = Path("test_output_ktx2")
+    out_dir.mkdir(parents=True, exist_ok=True)
+    img = pygli.load("data/kueken7_rgba8_unorm.dds")
+    for level in [0, 3, 19]:
+        path_out = f"{str(out_dir)}/zstd_{level}.ktx2"
+        assert pygli.save(path_out, img, pygli.Format.RGBA8_UNORM_PACK8, zstd_level=level)
+        assert np.array_equal(pygli.load(path_out), img)
+        assert np.array_equal(pygli.load(path_out, layout="CHW"), img.transpose(2, 0, 1))
+
+    # Layered KTX2 files decode through the batch path too
+    layers = np.random.rand(4, 32, 32, 4).astype(np.float32)
+    path_out = f"{str(out_dir)}/layers.ktx2"
+    assert pygli.save(path_out, layers, pygli.Format.RGBA32_SFLOAT_PACK32)
+    assert np.array_equal(pygli.load(path_out), layers[0])
+    batch = pygli.load_batch([path_out] * 2)
+    assert np.array_equal(batch[1], layers[0])
+
+    # Tidy Up
+    shutil.rmtree(out_dir)
+
+
+def test_load_image():
+    out_dir = Path("test_output_image")
+    out_dir.mkdir(parents=True, exist_ok=True)
+    rgb = np.random.randint(0, 255, size=[48, 64, 3], dtype=np.uint8)
+    rgba16 = np.random.randint(0, 65535, size=[48, 64, 4], dtype=np.uint16)
+    write_png(f"{out_dir}/rgb.png", rgb)
+    write_png(f"{out_dir}/rgba16.png", rgba16)
+    write_tga(f"{out_dir}/rgb.tga", rgb)
+
+    assert np.array_equal(pygli.load(f"{out_dir}/rgb.png"), rgb)
+    assert np.array_equal(pygli.load(f"{out_dir}/rgba16.png"), rgba16)
+    assert pygli.load(f"{out_dir}/rgba16.png").dtype == np.uint16
+    assert np.array_equal(pygli.load(f"{out_dir}/rgb.tga"), rgb)
+    assert np.array_equal(pygli.load(f"{out_dir}/rgb.png", layout="CHW"), rgb.transpose(2, 0, 1))
+
+    # Mixed containers with matching shapes batch together
+    batch = pygli.load_batch([f"{out_dir}/rgb.png", f"{out_dir}/rgb.tga"])
+    assert np.array_equal(batch[0], batch[1])
+
+    # Tidy Up
+    shutil.rmtree(out_dir)
+
+
+def test_pack():
+    out_dir = Path("test_output_pack")
+    out_dir.mkdir(parents=True, exist_ok=True)
+    paths = ["data/kueken7_rgba8_unorm.dds", "data/kueken7_rgba16_sfloat.dds", "data/array_r8_uint.dds"]
+    pack_path = f"{out_dir}/textures.pack"
+    pygli.write_pack(pack_path, paths, num_threads=2)
+
+    pack = pygli.Pack(pack_path)
+    assert len(pack) == 3
+    assert pack.keys() == sorted(paths)
+    for path in paths:
+        assert path in pack
+        assert np.array_equal(pack[path], pygli.load(path))
+    assert np.array_equal(pack.load(paths[0], layout="CHW"), pygli.load(paths[0], layout="CHW"))
+
+    # Uncompressed texels come back as read-only views of the mapping
+    assert not pack[paths[0]].flags.writeable
+    assert pack[paths[1]].dtype == np.float32
+
+    failed = False
+    try:
+        pack["missing"]
+    except KeyError:
+        failed = True
+    assert failed
+
+    # Appending adds new names and replaces existing ones
+    del pack
+    pygli.write_pack(pack_path, [paths[2], paths[2]], names=["extra", paths[0]], append=True)
+    pack = pygli.Pack(pack_path)
+    assert len(pack) == 4
+    assert np.array_equal(pack["extra"], pygli.load(paths[2]))
+    assert np.array_equal(pack[paths[0]], pygli.load(paths[2]))
+    del pack
+
+    # An entry claiming more texels than its bytes hold is refused rather than read past
+    corrupt_path = f"{out_dir}/corrupt.pack"
+    pygli.write_pack(corrupt_path, [paths[0]])
+    data = bytearray(Path(corrupt_path).read_bytes())
+    index_offset = struct.unpack_from("<Q", data, 16)[0]
+    struct.pack_into("<I", data, index_offset + 36, 1 << 20)
+    Path(corrupt_path).write_bytes(bytes(data))
+    pack = pygli.Pack(corrupt_path)
+    failed = False
+    try:
+        pack[paths[0]]
+    except RuntimeError:
+        failed = True
+    assert failed
+    del pack
+
+    # Tidy Up
+    shutil.rmtree(out_dir)
+
+
+def test_shared():
+    path = "data/kueken7_rgba8_unorm.dds"
+    img, handle = pygli.load(path, shared=True)
+    assert np.array_equal(img, pygli.load(path))
+    assert handle.shape == list(img.shape)
+    assert handle.nbytes == img.nbytes
+
+    # Unpickling reattaches to the same memory rather than copying it
+    other = pickle.loads(pickle.dumps(handle))
+    view = other.array()
+    assert other.name == handle.name
+    view[0, 0, 0] = 255 - img[0, 0, 0]
+    assert img[0, 0, 0] == view[0, 0, 0]
+    del img, handle, other, view
+
+    batch, handle = pygli.load_batch([path] * 2, shared=True)
+    assert np.array_equal(batch[1], pygli.load(path))
+    assert np.array_equal(pickle.loads(pickle.dumps(handle)).array(), batch)
+
+
+def test_save_views():
+    out_dir = Path("test_output_views")
+    out_dir.mkdir(parents=True, exist_ok=True)
+    img = np.random.randint(0, 255, size=[64, 128, 4], dtype=np.uint8)
+    views = {
+        "strided.dds": img[:, ::2],
+        "flipped.dds": img[::-1],
+        "rgb.dds": img[..., :3],
+    }
+    for name, view in views.items():
+        path_out = f"{str(out_dir)}/{name}"
+        fmt = pygli.Format.RGB8_UNORM_PACK8 if view.shape[2] == 3 else pygli.Format.RGBA8_UNORM_PACK8
+        assert pygli.save(path_out, view, fmt)
+        assert np.array_equal(pygli.load(path_out), view)
+
+    # Half formats round trip from float16, widened to float32 on load
+    half = np.random.rand(32, 32, 4).astype(np.float16)
+    assert pygli.save(f"{str(out_dir)}/half.dds", half, pygli.Format.RGBA16_SFLOAT_PACK16)
+    assert np.array_equal(pygli.load(f"{str(out_dir)}/half.dds"), half.astype(np.float32))
+
+    # BGR(A) formats are stored swizzled and come back in RGB(A) order
+    for fmt, view in [(pygli.Format.BGRA8_UNORM_PACK8, img), (pygli.Format.BGR8_UNORM_PACK8, img[..., :3])]:
+        assert pygli.save(f"{str(out_dir)}/bgr.dds", view, fmt)
+        assert np.array_equal(pygli.load(f"{str(out_dir)}/bgr.dds"), view)
+        assert np.array_equal(pygli.load(f"{str(out_dir)}/bgr.dds", layout="CHW"), view.transpose(2, 0, 1))
+
+    # The array's channels and dtype have to match the format, same sized dtypes of another kind too
+    scalar = img[..., :1]
+    for arr, fmt in [(img, pygli.Format.RGB8_UNORM_PACK8), (img.astype(np.uint16), pygli.Format.RGBA8_UNORM_PACK8),
+                     (scalar.astype(np.int32), pygli.Format.R32_SFLOAT_PACK32), (scalar.astype(np.float16), pygli.Format.R16_UNORM_PACK16),
+                     (img.astype(np.int8), pygli.Format.RGBA8_UNORM_PACK8)]:
+        failed = False
+        try:
+            pygli.save(f"{str(out_dir)}/bad.dds", arr, fmt)
+        except ValueError:
+            failed = True
+        assert failed
+
+    # Tidy Up
+    shutil.rmtree(out_dir)
+
+
+def test_load_resize():
+    path = "data/kueken7_rgba8_unorm.dds"
+    full = pygli.load(path)
+    for name in ["nearest", "box", "bilinear", "lanczos3"]:
+        img = pygli.load(path, size=(64, 32), filter=name)
+        assert list(img.shape) == [32, 64, 4]
+        assert img.dtype == np.uint8
+
+    # Same size is a copy and halving with box is the 2x2 average
+    assert np.array_equal(pygli.load(path, size=(256, 256)), full)
+    half = full.astype(np.float32).reshape(128, 2, 128, 2, 4).mean(axis=(1, 3))
+    assert np.abs(pygli.load(path, size=(128, 128)).astype(np.float32) - half).max() <= 1
+
+    chw = pygli.load(path, size=(64, 32), layout="CHW")
+    assert np.array_equal(chw, np.transpose(pygli.load(path, size=(64, 32)), (2, 0, 1)))
+    assert pygli.load("data/kueken7_rgba16_sfloat.dds", size=(100, 50)).dtype == np.float32
+
+    for kwargs in [{"size": (64, 64), "filter": "cubic"}, {"size": (0, 64)}]:
+        failed = False
+        try:
+            pygli.load(path, **kwargs)
+        except ValueError:
+            failed = True
+        assert failed
+
+
+def test_stats():
+    path = "data/kueken7_rgba8_unorm.dds"
+    img, stats = pygli.load(path, stats=True)
+    flat = img.reshape(-1, 4).astype(np.float64)
+    assert np.array_equal(stats["min"], flat.min(axis=0))
+    assert np.array_equal(stats["max"], flat.max(axis=0))
+    assert np.allclose(stats["mean"], flat.mean(axis=0))
+    assert np.allclose(stats["std"], flat.std(axis=0))
+    assert stats["histogram"].shape == (4, 256)
+    assert np.array_equal(stats["histogram"][0], np.bincount(img[..., 0].ravel(), minlength=256))
+    assert np.array_equal(stats["nan"], [0, 0, 0, 0])
+
+    # Same numbers without keeping the pixels, and the planar output is unchanged by gathering them
+    assert np.array_equal(pygli.stats_of(path)["histogram"], stats["histogram"])
+    chw, _ = pygli.load(path, layout="CHW", stats=True)
+    assert np.array_equal(chw, pygli.load(path, layout="CHW"))
+
+    # NaN / Inf are counted and left out of the other statistics
+    out_dir = Path("test_output_stats")
+    out_dir.mkdir(parents=True, exist_ok=True)
+    hdr = np.random.rand(16, 16, 1).astype(np.float32)
+    hdr[0, 0, 0] = np.nan
+    hdr[1, 1, 0] = np.inf
+    assert pygli.save(f"{str(out_dir)}/bad.dds", hdr, pygli.Format.R32_SFLOAT_PACK32)
+    stats = pygli.stats_of(f"{str(out_dir)}/bad.dds")
+    assert stats["nan"][0] == 1 and stats["inf"][0] == 1 and stats["count"][0] == 254
+    finite = hdr[np.isfinite(hdr)]
+    assert np.isclose(stats["mean"][0], finite.mean()) and stats["max"][0] == finite.max()
+
+    # Tidy Up
+    shutil.rmtree(out_dir)
+
+
+def test_compare():
+    path = "data/kueken7_rgba8_unorm.dds"
+    img = pygli.load(path)
+    same = pygli.compare(path, img)
+    assert np.array_equal(same["mse"], [0, 0, 0, 0])
+    assert np.all(np.isinf(same["psnr"]))
+    assert np.allclose(same["ssim"], 1.0)
+
+    noisy = np.clip(img.astype(np.int16) + np.random.randint(-8, 9, img.shape), 0, 255).astype(np.uint8)
+    result = pygli.compare(img, noisy, metrics=["mse", "psnr", "maxabs"], num_threads=4)
+    diff = img.astype(np.float64) - noisy
+    mse = (diff ** 2).reshape(-1, 4).mean(axis=0)
+    assert np.allclose(result["mse"], mse)
+    assert np.allclose(result["psnr"], 10 * np.log10(255 ** 2 / mse))
+    assert np.array_equal(result["maxabs"], np.abs(diff).reshape(-1, 4).max(axis=0))
+    assert "ssim" not in result
+    ssim = pygli.compare(img, noisy, metrics=["ssim"])["ssim"]
+    assert np.all((ssim > 0.5) & (ssim < 1.0))
+
+    # Strided views and half textures against their float32 load
+    strided = pygli.compare(img[::2, ::2], noisy[::2, ::2], metrics=["mse"])["mse"]
+    assert np.allclose(strided, (diff[::2, ::2] ** 2).reshape(-1, 4).mean(axis=0))
+    half = "data/kueken7_rgba16_sfloat.dds"
+    assert np.array_equal(pygli.compare(half, pygli.load(half), metrics=["maxabs"])["maxabs"], [0, 0, 0, 0])
+
+    for b, kwargs in [(img[:64], {}), (img, {"metrics": ["lpips"]}), (img.astype(np.float32), {})]:
+        failed = False
+        try:
+            pygli.compare(img, b, **kwargs)
+        except ValueError:
+            failed = True
+        assert failed
+
+
+def test_buffer_pool():
+    pygli.clear_buffer_pool()
+    pygli.configure_buffer_pool(max_bytes=64 << 20)
+    for _ in range(3):
+        pygli.load("data/kueken7_rgba8_unorm.dds")
+    stats = pygli.buffer_pool_stats()
+    assert stats["hits"] >= 2
+    assert stats["cached_buffers"] >= 1 and 0 < stats["cached_bytes"] <= stats["max_bytes"]
+
+    # Disabling the cache frees what it holds, results are unaffected
+    pygli.configure_buffer_pool(max_bytes=0, huge_pages=True)
+    assert pygli.buffer_pool_stats()["cached_bytes"] == 0
+    assert np.array_equal(pygli.load("data/kueken7_rgba8_unorm.dds"), pygli.load("data/kueken7_rgba8_unorm.dds"))
+    pygli.configure_buffer_pool(max_bytes=256 << 20, huge_pages=False)
+
+
+def test_iterate():
+    paths = ["data/kueken7_rgba8_unorm.dds", "data/kueken7_rgba16_sfloat.dds", "data/array_r8_uint.dds"] * 4
+    images = list(pygli.iterate(paths, prefetch=3, num_threads=2))
+    assert len(images) == len(paths)
+    for path, img in zip(paths, images):
+        assert np.array_equal(img, pygli.load(path))
+
+    # Unordered yields (path, array) as they complete, load options apply to every image
+    done = dict(pygli.iterate(paths[:3], ordered=False, layout="CHW", size=(64, 64)))
+    assert sorted(done) == sorted(paths[:3])
+    assert np.array_equal(done[paths[0]], pygli.load(paths[0], layout="CHW", size=(64, 64)))
+
+    # A bad file only fails its own item
+    bad = [paths[0], "not_a_file.dds", paths[0]]
+    items = list(pygli.iterate(bad, errors="yield"))
+    assert isinstance(items[1], ValueError) and "not_a_file.dds" in str(items[1])
+    assert np.array_equal(items[2], pygli.load(paths[0]))
+    it = pygli.iterate(bad)
+    next(it)
+    failed = False
+    try:
+        next(it)
+    except ValueError:
+        failed = True
+    assert failed
+    assert np.array_equal(next(it), pygli.load(paths[0]))
+
+    it = pygli.iterate(paths * 10, prefetch=2)
+    next(it)
+    it.close()
+    assert list(it) == []
+
+
+def test_dlpack():
+    class Tensor:
+        # Stand-in for a framework tensor that only speaks DLPack
+        def __init__(self, array):
+            self.array = array
+
+        def __dlpack__(self, stream=None):
+            return self.array.__dlpack__()
+
+        def __dlpack_device__(self):
+            return (1, 0)
+
+    path = "data/kueken7_rgba8_unorm.dds"
+    out_dir = Path("test_output_dlpack")
+    out_dir.mkdir(parents=True, exist_ok=True)
+
+    # A loaded capsule saves straight back, and so does any object implementing __dlpack__
+    capsule = pygli.load(path, as_dlpack=True)
+    assert pygli.save(f"{str(out_dir)}/capsule.dds", capsule, pygli.Format.RGBA8_UNORM_PACK8)
+    assert np.array_equal(pygli.load(f"{str(out_dir)}/capsule.dds"), pygli.load(path))
+
+    img = np.random.randint(0, 255, size=[32, 64, 4], dtype=np.uint8)
+    assert pygli.save(f"{str(out_dir)}/tensor.dds", Tensor(img[:, ::2]), pygli.Format.RGBA8_UNORM_PACK8)
+    assert np.array_equal(pygli.load(f"{str(out_dir)}/tensor.dds"), img[:, ::2])
+
+    # Consumed by NumPy's own DLPack import
+    hdr = pygli.load("data/kueken7_rgba16_sfloat.dds", as_dlpack=True, layout="CHW")
+    wrapped = type("Capsule", (), {"__dlpack__": lambda self, **kw: hdr, "__dlpack_device__": lambda self: (1, 0)})()
+    assert np.array_equal(np.from_dlpack(wrapped), pygli.load("data/kueken7_rgba16_sfloat.dds", layout="CHW"))
+
+    failed = False
+    try:
+        pygli.load(path, as_dlpack=True, stats=True)
+    except ValueError:
+        failed = True
+    assert failed
+
+    # Tidy Up
+    shutil.rmtree(out_dir)
+
+
+def test_pack_atlas():
+    out_dir = Path("test_output_atlas")
+    out_dir.mkdir(parents=True, exist_ok=True)
+    images = [np.random.randint(0, 255, size=[h, w, 4], dtype=np.uint8) for h, w in [(30, 20), (8, 40), (17, 17), (64, 5)]]
+    images.append(images[0][::2, ::3])
+
+    uvs = pygli.pack_atlas(f"{str(out_dir)}/atlas.dds", images, pygli.Format.RGBA8_UNORM_PACK8, max_size=256, padding=2)
+    atlas = pygli.load(f"{str(out_dir)}/atlas.dds")
+    assert uvs.shape == (len(images), 4)
+    h, w = atlas.shape[:2]
+    for img, (u0, v0, u1, v1) in zip(images, uvs):
+        x0, y0, x1, y1 = round(u0 * w), round(v0 * h), round(u1 * w), round(v1 * h)
+        assert np.array_equal(atlas[y0:y1, x0:x1], img)
+        # Padding repeats the edge texels
+        assert np.array_equal(atlas[y0 - 2, x0:x1], img[0])
+        assert np.array_equal(atlas[y0:y1, x1 + 1], img[:, -1])
+
+    # Mips are box filtered, half formats included
+    hdr = [np.random.rand(16, 16, 4).astype(np.float16) for _ in range(3)]
+    uvs = pygli.pack_atlas(f"{str(out_dir)}/atlas_hdr.dds", hdr, pygli.Format.RGBA16_SFLOAT_PACK16, padding=0, mips=True)
+    atlas = pygli.load(f"{str(out_dir)}/atlas_hdr.dds")
+    x0, y0 = round(uvs[1][0] * atlas.shape[1]), round(uvs[1][1] * atlas.shape[0])
+    assert np.array_equal(atlas[y0:y0 + 16, x0:x0 + 16], hdr[1].astype(np.float32))
+
+    for max_size in [32, 2, 130]:
+        failed = False
+        try:
+            pygli.pack_atlas(f"{str(out_dir)}/too_big.dds", images, pygli.Format.RGBA8_UNORM_PACK8, max_size=max_size)
+        except ValueError:
+            failed = True
+        assert failed
+
+    # Tidy Up
+    shutil.rmtree(out_dir)
+
+
+def test_update():
+    out_dir = Path("test_output_update")
+    out_dir.mkdir(parents=True, exist_ok=True)
+    path = f"{str(out_dir)}/kueken7_rgba8_unorm.dds"
+    shutil.copy("data/kueken7_rgba8_unorm.dds", path)
+    img = pygli.load(path)
+
+    # Only the region's rows are written, everything else is untouched
+    tile = np.random.randint(0, 255, size=[16, 24, 4], dtype=np.uint8)
+    assert pygli.update(path, tile, region=(40, 8, 24, 16)) == tile.nbytes
+    img[8:24, 40:64] = tile
+    assert np.array_equal(pygli.load(path), img)
+
+    # A whole level of another layer lands at its offset in the file, layer 0 is untouched
+    array_path = f"{str(out_dir)}/array.dds"
+    shutil.copy("data/array_r8_uint.dds", array_path)
+    level = np.random.randint(0, 255, size=[256, 256, 1], dtype=np.uint8)[::2, ::2]
+    pygli.update(array_path, level, level=1, layer=2)
+    chain = sum((256 >> l) ** 2 for l in range(9))
+    offset = 148 + 2 * chain + 256 * 256
+    data = Path(array_path).read_bytes()
+    assert data[offset:offset + level.size] == level.tobytes()
+    assert np.array_equal(pygli.load(array_path), pygli.load("data/array_r8_uint.dds"))
+
+    for kwargs in [dict(region=(250, 0, 24, 16)), dict(level=9), dict(layer=1)]:
+        failed = False
+        try:
+            pygli.update(path, tile, **kwargs)
+        except ValueError:
+            failed = True
+        assert failed
+
+    # Files written by save() use legacy mask headers for these formats
+    for fmt, channels in [(pygli.Format.RGBA8_UNORM_PACK8, 4), (pygli.Format.R8_UNORM_PACK8, 1)]:
+        saved_path = f"{str(out_dir)}/saved_{channels}.dds"
+        saved = np.random.randint(0, 255, size=[32, 48, channels], dtype=np.uint8)
+        assert pygli.save(saved_path, saved, fmt)
+        tile = np.random.randint(0, 255, size=[8, 16, channels], dtype=np.uint8)
+        assert pygli.update(saved_path, tile, region=(16, 8, 16, 8)) == tile.nbytes
+        saved[8:16, 16:32] = tile
+        assert np.array_equal(pygli.load(saved_path).reshape(saved.shape), saved)
+
+    # Tidy Up
+    shutil.rmtree(out_dir)
+
+
+def test_threads():
+    import sys
+    import sysconfig
+    from concurrent.futures import ThreadPoolExecutor
+
+    # Importing the module must not turn the GIL back on in a free-threaded build
+    if sysconfig.get_config_var("Py_GIL_DISABLED"):
+        assert not sys._is_gil_enabled()
+
+    out_dir = Path("test_output_threads")
+    out_dir.mkdir(parents=True, exist_ok=True)
+    paths = ["data/kueken7_rgba8_unorm.dds", "data/kueken7_rgba16_sfloat.dds", "data/array_r8_uint.dds"]
+    expected = [pygli.load(p) for p in paths]
+    formats = [pygli.Format.RGBA8_UNORM_PACK8, pygli.Format.RGBA32_SFLOAT_PACK32, pygli.Format.R8_UINT_PACK8]
+
+    # Concurrent load / save round trips from many Python threads
+    def round_trip(i):
+        k = i % len(paths)
+        img = pygli.load(paths[k])
+        out = f"{str(out_dir)}/{i}.dds"
+        pygli.save(out, img, formats[k])
+        return k, pygli.load(out)
+
+    with ThreadPoolExecutor(max_workers=8) as pool:
+        for k, img in pool.map(round_trip, range(48)):
+            assert np.array_equal(img, expected[k])
+
+    # Tidy Up
+    shutil.rmtree(out_dir)
+
+
+def test_save_tiled():
+    out_dir = Path("test_output_tiled")
+    out_dir.mkdir(parents=True, exist_ok=True)
+    img = np.random.randint(0, 255, size=[300, 200, 4], dtype=np.uint8)
+    mm = np.lib.format.open_memmap(f"{str(out_dir)}/source.npy", mode="w+", dtype=np.uint8, shape=img.shape)
+    mm[:] = img
+    mm.flush()
+
+    # Array, memmap and row callback sources give the same page file
+    n = pygli.save_tiled(f"{str(out_dir)}/array.vt", img, pygli.Format.RGBA8_UNORM_PACK8, tile=64, border=4, zstd_level=0)
+    pygli.save_tiled(f"{str(out_dir)}/memmap.vt", mm, pygli.Format.RGBA8_UNORM_PACK8, tile=64, border=4, zstd_level=0)
+    pygli.save_tiled(f"{str(out_dir)}/rows.vt", lambda y0, y1: img[y0:y1], pygli.Format.RGBA8_UNORM_PACK8,
+                     tile=64, border=4, shape=img.shape[:2], zstd_level=0)
+    data = Path(f"{str(out_dir)}/array.vt").read_bytes()
+    assert Path(f"{str(out_dir)}/memmap.vt").read_bytes() == data
+    assert Path(f"{str(out_dir)}/rows.vt").read_bytes() == data
+
+    # 64 byte header, tiles, then (offset, size, level, x, y) per tile sorted by level, y, x
+    magic, _, _, width, height, tile, border, levels, _, index_offset, count = struct.unpack_from("<8s8I2Q", data)
+    assert (magic, width, height, tile, border, levels) == (b"PYGLIVT1", 200, 300, 64, 4, 4)
+    assert count == n == 4 * 5 + 2 * 3 + 1 * 2 + 1
+    index = [struct.unpack_from("<Q4I", data, index_offset + 24 * i) for i in range(count)]
+    assert [e[2:] for e in index[:3]] == [(0, 0, 0), (0, 1, 0), (0, 2, 0)]
+
+    # Tile (1, 2) of level 0 with its border, padded past the right edge by repeating it
+    offset, size = next(e[:2] for e in index if e[2:] == (0, 1, 2))
+    side = tile + 2 * border
+    assert size == side * side * 4
+    tile_img = np.frombuffer(data, np.uint8, side * side * 4, offset).reshape(side, side, 4)
+    rows = np.clip(np.arange(128 - 4, 192 + 4), 0, 299)
+    cols = np.clip(np.arange(64 - 4, 128 + 4), 0, 199)
+    assert np.array_equal(tile_img, img[rows][:, cols])
+
+    # Compressed tiles, half formats
+    hdr = np.random.rand(100, 100, 4).astype(np.float16)
+    assert pygli.save_tiled(f"{str(out_dir)}/hdr.vt", hdr, pygli.Format.RGBA16_SFLOAT_PACK16, tile=32) == 16 + 4 + 1
+
+    failed = False
+    try:
+        pygli.save_tiled(f"{str(out_dir)}/bad.vt", lambda y0, y1: img[y0:y1], pygli.Format.RGBA8_UNORM_PACK8)
+    except ValueError:
+        failed = True
+    assert failed
+
+    # Tidy Up
+    del mm
+    shutil.rmtree(out_dir)
+
+
+def test_save_async():
+    out_dir = Path("test_output_save_async")
+    out_dir.mkdir(parents=True, exist_ok=True)
+    frames = [np.random.randint(0, 255, size=[64, 64, 4], dtype=np.uint8) for _ in range(8)]
+
+    # The array is snapshotted, so the producer can overwrite it straight away
+    buffer = np.empty_like(frames[0])
+    futures = []
+    for i, frame in enumerate(frames):
+        buffer[:] = frame
+        futures.append(pygli.save_async(f"{str(out_dir)}/{i}.dds", buffer, pygli.Format.RGBA8_UNORM_PACK8))
+    assert all(f.result() for f in futures)
+    for i, frame in enumerate(frames):
+        assert np.array_equal(pygli.load(f"{str(out_dir)}/{i}.dds"), frame)
+
+    # Strided views are snapshotted too, the writer converts the copy
+    padded = np.zeros([64, 80, 4], dtype=np.uint8)
+    padded[:, 8:72] = frames[1]
+    future = pygli.save_async(f"{str(out_dir)}/view.dds", padded[:, 8:72], pygli.Format.BGRA8_UNORM_PACK8)
+    padded[:] = 0
+    assert future.result()
+    assert np.array_equal(pygli.load(f"{str(out_dir)}/view.dds"), frames[1])
+
+    # The snapshot doesn't keep the array alive, it can be freed before the write finishes
+    import gc
+    import weakref
+    source = frames[2].copy()
+    source_ref = weakref.ref(source)
+    future = pygli.save_async(f"{str(out_dir)}/freed.dds", source, pygli.Format.RGBA8_UNORM_PACK8)
+    del source
+    gc.collect()
+    assert source_ref() is None
+    assert future.result()
+    assert np.array_equal(pygli.load(f"{str(out_dir)}/freed.dds"), frames[2])
+
+    # copy=False hands the array to the writer, flush() waits for everything queued
+    pygli.save_async(f"{str(out_dir)}/owned.ktx2", frames[0][:, :, :], pygli.Format.RGBA8_UNORM_PACK8, copy=False)
+    pygli.flush()
+    assert np.array_equal(pygli.load(f"{str(out_dir)}/owned.ktx2"), frames[0])
+
+    # Write errors come back through the future
+    failed = False
+    try:
+        pygli.save_async(f"{str(out_dir)}/bad.png", frames[0], pygli.Format.RGBA8_UNORM_PACK8).result(timeout=10)
+    except (ValueError, RuntimeError):
+        failed = True
+    assert failed
+
+    stats = pygli.save_async_stats()
+    assert stats["queued"] == 0 and stats["active"] == 0
+    assert stats["completed"] >= 9 and stats["failed"] >= 1
+    assert stats["max_latency"] >= stats["mean_latency"] > 0
+
+    # Tidy Up
+    shutil.rmtree(out_dir)
+
+
 def test_save():
     formats = {
         pygli.Format.R8_UNORM_PACK8 : {"ch" : 1, "dtype" : np.uint8, "max" : np.iinfo(np.uint8).max},